@@ -0,0 +1,408 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <argp.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "log.h"
+#include "config.h"
+#include "pipeline.h"
+#include "utils.h"
+#include "tokenize.h"
+
+// Measures the throughput of the whole pipeline on a fixed corpus at increasing thread counts,
+// with and without seam carving, and writes the results as JSON.
+
+struct BenchConfig
+{
+	std::filesystem::path corpusDir;
+	std::filesystem::path workDir = "smartcrop_bench";
+	std::filesystem::path outputPath;
+	std::filesystem::path personImage = BENCH_PERSON_IMAGE;
+	size_t imageCount = 48;
+	size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	uint64_t seed = 1;
+};
+
+struct RunResult
+{
+	size_t threads;
+	bool seamCarving;
+	size_t completed = 0;
+	size_t failed = 0;
+	double wallSeconds = 0;
+	double steadySeconds = 0;
+	// time an image spends being worked on in the stages, without the time it waits in queues,
+	// which with the whole corpus pushed at once only grows with its size
+	double latencyP50 = 0;
+	double latencyP99 = 0;
+	double stageBusy[Pipeline::STAGE_COUNT] = {};
+	size_t peakRss = 0;
+};
+
+const char *argp_program_version = "AIImagePreprocesses";
+const char *argp_program_bug_address = "<carl@uvos.xyz>";
+static char doc[] = "Benchmark of the SmartCrop pipeline on a synthetic or given corpus, results are written as JSON";
+static char args_doc[] = "";
+
+static struct argp_option options[] =
+{
+  {"corpus",		'c', "[DIRECTORY]",	0,	"benchmark on the images in this directory instead of on a synthetic corpus"},
+  {"work-dir",		'w', "[DIRECTORY]",	0,	"directory the synthetic corpus and the outputs are written to, default: smartcrop_bench"},
+  {"output",		'o', "[FILENAME]",	0,	"write the JSON results to this file instead of stdout"},
+  {"person-image",	'p', "[FILENAME]",	0,	"image of a person that is pasted into half of the synthetic images"},
+  {"count",		'n', "[NUMBER]",	0,	"number of synthetic images, default: 48"},
+  {"threads",		'j', "[NUMBER]",	0,	"the largest number of threads per stage to benchmark, runs are done at powers of two up to it, default: number of cpus"},
+  {"seed",		's', "[NUMBER]",	0,	"seed of the synthetic corpus, default: 1"},
+  {0}
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
+{
+	BenchConfig *config = reinterpret_cast<BenchConfig*>(state->input);
+	try
+	{
+		switch (key)
+		{
+			case 'c':
+				config->corpusDir = arg;
+				break;
+			case 'w':
+				config->workDir = arg;
+				break;
+			case 'o':
+				config->outputPath = arg;
+				break;
+			case 'p':
+				config->personImage = arg;
+				break;
+			case 'n':
+			case 'j':
+			{
+				int count = std::stoi(arg);
+				if(count < 1)
+				{
+					std::cout<<arg<<" is not a valid count, it must be at least 1\n";
+					return ARGP_KEY_ERROR;
+				}
+				if(key == 'n')
+					config->imageCount = count;
+				else
+					config->maxThreads = count;
+				break;
+			}
+			case 's':
+				config->seed = std::stoull(arg);
+				break;
+			case ARGP_KEY_ARG:
+				argp_usage(state);
+				break;
+			default:
+				return ARGP_ERR_UNKNOWN;
+		}
+	}
+	catch(const std::invalid_argument& ex)
+	{
+		std::cout<<arg<<" passed for argument -"<<static_cast<char>(key)<<" is not a valid number.\n";
+		return ARGP_KEY_ERROR;
+	}
+	return 0;
+}
+
+static struct argp argp = {options, parse_opt, args_doc, doc};
+
+// a spread of camera, screen, portrait and panorama formats
+static const cv::Size corpusSizes[] =
+{
+	cv::Size(640, 480),
+	cv::Size(1920, 1080),
+	cv::Size(1080, 1920),
+	cv::Size(2048, 2048),
+	cv::Size(3000, 2000),
+	cv::Size(2000, 3000),
+	cv::Size(4000, 3000),
+	cv::Size(1200, 800),
+	cv::Size(5000, 1500),
+	cv::Size(1500, 5000),
+};
+
+static cv::Mat syntheticImage(cv::RNG& rng, const cv::Size& size, const cv::Mat& person)
+{
+	// a gradient with shapes and noise, so that seam carving and the encoder have structure to work on
+	cv::Mat image(size, CV_8UC3);
+	cv::Vec3f top(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+	cv::Vec3f bottom(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+	for(int y = 0; y < image.rows; ++y)
+	{
+		float blend = static_cast<float>(y)/image.rows;
+		cv::Vec3f color = top*(1-blend) + bottom*blend;
+		image.row(y).setTo(cv::Scalar(color[0], color[1], color[2]));
+	}
+
+	int minSide = std::min(size.width, size.height);
+	for(int i = 0; i < 24; ++i)
+	{
+		cv::Point center(rng.uniform(0, size.width), rng.uniform(0, size.height));
+		cv::Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+		int extent = rng.uniform(minSide/32+1, minSide/4+2);
+		if(i % 2 == 0)
+			cv::circle(image, center, extent, color, cv::FILLED);
+		else
+			cv::rectangle(image, cv::Rect(center.x, center.y, extent*2, extent), color, cv::FILLED);
+	}
+
+	cv::Mat noise(size, CV_8UC3);
+	rng.fill(noise, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(16));
+	image += noise;
+	image -= cv::Scalar::all(8);
+
+	if(!person.empty())
+	{
+		double scale = std::min(size.height*rng.uniform(0.4, 0.9)/person.rows, size.width*0.9/person.cols);
+		cv::Mat scaled;
+		cv::resize(person, scaled, cv::Size(), scale, scale, cv::INTER_AREA);
+		cv::Point origin(rng.uniform(0, size.width-scaled.cols+1), rng.uniform(0, size.height-scaled.rows+1));
+		scaled.copyTo(image(cv::Rect(origin, scaled.size())));
+	}
+	return image;
+}
+
+static bool generateCorpus(const BenchConfig& bench, std::vector<std::filesystem::path>& paths)
+{
+	std::filesystem::path corpusDir = bench.workDir/"corpus";
+	std::filesystem::create_directories(corpusDir);
+
+	cv::Mat person;
+	if(!bench.personImage.empty())
+	{
+		person = cv::imread(bench.personImage);
+		if(person.empty())
+			Log(Log::WARN)<<"could not load "<<bench.personImage<<", the synthetic corpus will contain no persons";
+	}
+
+	// images are only generated when missing, the same seed and count always gives the same corpus
+	cv::RNG rng(bench.seed);
+	size_t sizeCount = sizeof(corpusSizes)/sizeof(*corpusSizes);
+	for(size_t i = 0; i < bench.imageCount; ++i)
+	{
+		std::filesystem::path path = corpusDir/("synthetic-" + std::to_string(bench.seed) + "-" + std::to_string(i) + ".jpg");
+		paths.push_back(path);
+		cv::Mat image = syntheticImage(rng, corpusSizes[i % sizeCount], i % 2 == 0 ? person : cv::Mat());
+		if(std::filesystem::exists(path))
+			continue;
+		if(!cv::imwrite(path.string(), image, {cv::IMWRITE_JPEG_QUALITY, 90}))
+		{
+			Log(Log::ERROR)<<"could not write "<<path;
+			return false;
+		}
+	}
+	return true;
+}
+
+// resets the peak resident set size of the process so that each run reports its own
+static void resetPeakRss()
+{
+	std::ofstream file("/proc/self/clear_refs");
+	file<<"5";
+}
+
+static size_t peakRss()
+{
+	std::ifstream file("/proc/self/status");
+	std::string line;
+	while(std::getline(file, line))
+	{
+		if(line.compare(0, 6, "VmHWM:") == 0)
+			return std::stoull(line.substr(6))*1024;
+	}
+	return 0;
+}
+
+static double percentile(const std::vector<double>& sorted, double fraction)
+{
+	if(sorted.empty())
+		return 0;
+	size_t index = std::min(sorted.size()-1, static_cast<size_t>(fraction*sorted.size()));
+	return sorted[index];
+}
+
+static RunResult runPipeline(const BenchConfig& bench, const std::vector<std::filesystem::path>& corpus, size_t threads, bool seamCarving)
+{
+	RunResult result;
+	result.threads = threads;
+	result.seamCarving = seamCarving;
+
+	Config config;
+	config.seamCarving = seamCarving;
+	config.decodeThreads = threads;
+	config.detectThreads = threads;
+	config.cropThreads = threads;
+	config.encodeThreads = threads;
+	config.outputDir = bench.workDir/("run-" + std::to_string(threads) + (seamCarving ? "-seam" : ""));
+	std::filesystem::remove_all(config.outputDir);
+	std::filesystem::create_directories(config.outputDir);
+
+	std::mutex mutex;
+	std::vector<double> latencies;
+	std::chrono::steady_clock::time_point firstDone;
+	std::chrono::steady_clock::time_point lastDone;
+
+	resetPeakRss();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	{
+		Pipeline pipeline(config, nullptr, config.outputDir/"debug");
+		pipeline.setResultCallback([&](const ImageJob& job, bool ok)
+		{
+			std::chrono::duration<double> latency = std::chrono::duration<double>::zero();
+			for(const std::chrono::duration<double>& stageTime : job.stageTimes)
+				latency += stageTime;
+			std::lock_guard<std::mutex> lock(mutex);
+			latencies.push_back(latency.count());
+		});
+		pipeline.setCompletionCallback([&](const std::filesystem::path& path, bool ok)
+		{
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			std::lock_guard<std::mutex> lock(mutex);
+			if(!ok)
+				++result.failed;
+			if(result.completed == 0)
+				firstDone = now;
+			lastDone = now;
+			++result.completed;
+		});
+
+		for(const std::filesystem::path& path : corpus)
+			pipeline.push(path);
+		pipeline.finish();
+
+		for(size_t stage = 0; stage < Pipeline::STAGE_COUNT; ++stage)
+		{
+			for(const WorkerStats& stat : pipeline.getStats(static_cast<Pipeline::Stage>(stage)))
+				result.stageBusy[stage] += stat.busy.count();
+		}
+	}
+	result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.steadySeconds = std::chrono::duration<double>(lastDone - firstDone).count();
+	result.peakRss = peakRss();
+
+	std::sort(latencies.begin(), latencies.end());
+	result.latencyP50 = percentile(latencies, 0.5);
+	result.latencyP99 = percentile(latencies, 0.99);
+	return result;
+}
+
+static void writeJson(std::ostream& out, const BenchConfig& bench, const std::vector<std::filesystem::path>& corpus, const std::vector<RunResult>& results)
+{
+	size_t corpusBytes = 0;
+	for(const std::filesystem::path& path : corpus)
+		corpusBytes += std::filesystem::file_size(path);
+
+	out<<"{\n";
+	out<<"  \"cpus\": "<<std::thread::hardware_concurrency()<<",\n";
+	out<<"  \"corpus\": {\"path\": \""<<escapeJson(bench.corpusDir.empty() ? (bench.workDir/"corpus").string() : bench.corpusDir.string())<<"\""
+		<<", \"synthetic\": "<<(bench.corpusDir.empty() ? "true" : "false")<<", \"seed\": "<<bench.seed
+		<<", \"images\": "<<corpus.size()<<", \"bytes\": "<<corpusBytes<<"},\n";
+	out<<"  \"runs\": [\n";
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		const RunResult& result = results[i];
+		double steadyRate = result.completed > 1 && result.steadySeconds > 0 ? (result.completed-1)/result.steadySeconds : 0;
+		out<<"    {\"threadsPerStage\": "<<result.threads<<", \"seamCarving\": "<<(result.seamCarving ? "true" : "false")
+			<<", \"images\": "<<result.completed<<", \"failed\": "<<result.failed
+			<<", \"wallSeconds\": "<<result.wallSeconds<<", \"imagesPerSecond\": "<<result.completed/result.wallSeconds
+			<<", \"steadyImagesPerSecond\": "<<steadyRate
+			<<", \"latencyMs\": {\"p50\": "<<result.latencyP50*1000<<", \"p99\": "<<result.latencyP99*1000<<"}"
+			<<", \"stageBusySeconds\": {";
+		for(size_t stage = 0; stage < Pipeline::STAGE_COUNT; ++stage)
+		{
+			out<<(stage > 0 ? ", \"" : "\"")<<Pipeline::stageName(static_cast<Pipeline::Stage>(stage))<<"\": "<<result.stageBusy[stage];
+		}
+		out<<"}, \"peakRssBytes\": "<<result.peakRss<<"}"<<(i+1 < results.size() ? "," : "")<<'\n';
+	}
+	out<<"  ]\n";
+	out<<"}\n";
+}
+
+int main(int argc, char* argv[])
+{
+	BenchConfig bench;
+	argp_parse(&argp, argc, argv, 0, 0, &bench);
+	// stdout may carry the results
+	Log::toStderr = true;
+	Log::level = Log::WARN;
+
+	std::vector<std::filesystem::path> corpus;
+	if(!bench.corpusDir.empty())
+	{
+		getImageFiles(bench.corpusDir, corpus);
+		std::sort(corpus.begin(), corpus.end());
+	}
+	else if(!generateCorpus(bench, corpus))
+	{
+		return 1;
+	}
+
+	if(corpus.empty())
+	{
+		Log(Log::ERROR)<<"no image was found in "<<bench.corpusDir;
+		return 1;
+	}
+
+	std::vector<size_t> threadCounts;
+	for(size_t threads = 1; threads < bench.maxThreads; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(bench.maxThreads);
+
+	std::vector<RunResult> results;
+	for(bool seamCarving : {false, true})
+	{
+		for(size_t threads : threadCounts)
+		{
+			std::cerr<<"Running with "<<threads<<" threads per stage"<<(seamCarving ? " and seam carving" : "")<<std::endl;
+			results.push_back(runPipeline(bench, corpus, threads, seamCarving));
+		}
+	}
+
+	if(bench.outputPath.empty())
+	{
+		writeJson(std::cout, bench, corpus, results);
+	}
+	else
+	{
+		std::ofstream file(bench.outputPath);
+		if(!file.is_open())
+		{
+			Log(Log::ERROR)<<"could not open "<<bench.outputPath<<" for writing";
+			return 1;
+		}
+		writeJson(file, bench, corpus, results);
+	}
+	return 0;
+}
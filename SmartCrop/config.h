@@ -0,0 +1,118 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <filesystem>
+#include <opencv2/core/types.hpp>
+
+struct Config
+{
+	enum ResumeMode
+	{
+		RESUME_OFF,
+		RESUME_INPUT,
+		RESUME_CONFIG
+	};
+
+	enum MatAllocatorMode
+	{
+		MAT_ALLOCATOR_STD,
+		MAT_ALLOCATOR_POOL,
+		MAT_ALLOCATOR_POOL_HUGE
+	};
+
+	std::vector<std::filesystem::path> imagePaths;
+	std::filesystem::path modelPath;
+	std::filesystem::path classesPath;
+	std::filesystem::path outputDir;
+	std::filesystem::path focusPersonImage;
+	bool seamCarving = false;
+	bool debug = false;
+	double threshold = 0.363;
+	std::vector<cv::Size> targetSizes = {cv::Size(1024, 1024)};
+	// when set every image is croped to the single bucket that suits it best instead of to all targetSizes
+	std::vector<cv::Size> buckets;
+	size_t crawlThreads = 4;
+	size_t decodeThreads = 1;
+	size_t detectThreads = 1;
+	size_t cropThreads = 1;
+	size_t encodeThreads = 1;
+	size_t queueDepth = 4;
+	size_t batchSize = 1;
+	int proxySize = 0;
+	// number of queued files per decode thread the kernel is asked to read ahead
+	size_t readAhead = 4;
+	bool keepPageCache = false;
+	std::filesystem::path journalPath;
+	ResumeMode resume = RESUME_CONFIG;
+	bool journalHash = false;
+	std::filesystem::path detectionCachePath;
+	size_t shardIndex = 0;
+	size_t shardCount = 1;
+	uint16_t serveQueuePort = 0;
+	// serve crop requests on this UNIX socket instead of processing the inputs
+	std::filesystem::path daemonSocket;
+	// read JSON job records from stdin and write the results to stdout instead of processing the inputs
+	bool streamJobs = false;
+	std::string workerAddress;
+	size_t leaseSize = 16;
+	int leaseTimeout = 300;
+	// maximum size in bytes of the tar shards outputs are written to, 0 to write individual files
+	uint64_t outputTarSize = 0;
+	// write the outputs as raw tensors into one PackedWriter file per output size
+	bool packedOutput = false;
+	// encode the outputs and hand them to the pipelines result callback instead of saving them
+	bool inMemoryOutput = false;
+	// extension of the format outputs are encoded in, empty for the format of the input
+	std::string outputFormat;
+	// encoder settings, -1 uses the OpenCV default
+	int jpegQuality = -1;
+	int pngCompression = -1;
+	int webpQuality = -1;
+	// sync the outputs to disk in batches before they are recorded in the journal
+	bool durable = false;
+	size_t syncInterval = 256;
+	// estimated bytes images in flight may hold, 0 for no limit
+	size_t maxInflightMem = 0;
+	// hamming radius of perceptual hashes within which images are skipped as duplicates, -1 to disable deduplication
+	int dedupRadius = -1;
+	MatAllocatorMode matAllocator = MAT_ALLOCATOR_STD;
+	// bytes of free buffers the pooled allocator keeps for reuse
+	size_t matPoolSize = size_t(512)*1024*1024;
+	// load every model when the pipeline starts instead of on first use, for long running processes
+	bool preloadModels = false;
+
+	const std::vector<cv::Size>& outputSizes() const
+	{
+		return buckets.empty() ? targetSizes : buckets;
+	}
+};
+
+// settings of a single image that take the place of the ones in Config
+struct ImageOptions
+{
+	std::vector<cv::Size> targetSizes;
+	bool seamCarving = false;
+	// extension of the format outputs are encoded in, empty for the one of Config
+	std::string outputFormat;
+};
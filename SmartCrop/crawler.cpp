@@ -0,0 +1,190 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "crawler.h"
+
+#include <thread>
+#include <cstring>
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "hash.h"
+#include "log.h"
+
+Crawler::Crawler(Callback callbackIn, size_t threads): callback(callbackIn), threadCount(threads > 0 ? threads : 1)
+{
+	for(size_t i = 0; i < threadCount; ++i)
+		arenas.push_back(std::make_unique<StringArena>());
+}
+
+void Crawler::setShard(size_t index, size_t count)
+{
+	shardIndex = index;
+	shardCount = count > 0 ? count : 1;
+}
+
+void Crawler::setIncludeArchives(bool include)
+{
+	includeArchives = include;
+}
+
+bool Crawler::inShard(const std::string_view& relativePath) const
+{
+	if(shardCount < 2)
+		return true;
+	return hashBytes(relativePath.data(), relativePath.size()) % shardCount == shardIndex;
+}
+
+void Crawler::scanDirectory(const Directory& directory, StringArena& arena, std::vector<Directory>& subdirectories)
+{
+	DIR* dir = opendir(directory.path);
+	if(!dir)
+	{
+		Log(Log::WARN)<<"could not open directory "<<directory.path<<": "<<std::strerror(errno);
+		return;
+	}
+
+	std::string_view dirPath(directory.path);
+	std::string_view separator = !dirPath.empty() && dirPath.back() == '/' ? "" : "/";
+
+	while(struct dirent* entry = readdir(dir))
+	{
+		if(std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		unsigned char type = entry->d_type;
+		if(type == DT_UNKNOWN || type == DT_LNK)
+		{
+			struct stat st;
+			if(fstatat(dirfd(dir), entry->d_name, &st, 0) != 0)
+				continue;
+			if(S_ISDIR(st.st_mode))
+				type = DT_DIR;
+			else if(S_ISREG(st.st_mode))
+				type = DT_REG;
+			else
+				continue;
+		}
+
+		if(type == DT_DIR)
+		{
+			subdirectories.push_back({arena.store({dirPath, separator, entry->d_name}), directory.rootLength});
+		}
+		else if(type == DT_REG && (hasImageExtension(entry->d_name) || (includeArchives && hasTarExtension(entry->d_name))))
+		{
+			std::string filePath;
+			filePath.reserve(dirPath.size() + separator.size() + std::strlen(entry->d_name));
+			filePath.append(dirPath).append(separator).append(entry->d_name);
+			if(!inShard(std::string_view(filePath).substr(std::min(directory.rootLength, filePath.size()))))
+			{
+				++otherShards;
+				continue;
+			}
+			++found;
+			callback(filePath);
+		}
+	}
+	closedir(dir);
+	++scanned;
+}
+
+void Crawler::worker(size_t id)
+{
+	StringArena& arena = *arenas[id];
+	std::vector<Directory> subdirectories;
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true)
+	{
+		cond.wait(lock, [this](){return !directories.empty() || active == 0;});
+		if(directories.empty())
+			break;
+
+		// depth first keeps the number of pending directories small
+		Directory directory = directories.back();
+		directories.pop_back();
+		++active;
+		lock.unlock();
+
+		subdirectories.clear();
+		scanDirectory(directory, arena, subdirectories);
+
+		lock.lock();
+		--active;
+		directories.insert(directories.end(), subdirectories.begin(), subdirectories.end());
+		cond.notify_all();
+	}
+}
+
+void Crawler::crawl(const std::vector<std::filesystem::path>& roots)
+{
+	for(const std::filesystem::path& root : roots)
+	{
+		if(isImagePath(root) || (includeArchives && hasTarExtension(root.native()) && std::filesystem::is_regular_file(root)))
+		{
+			if(!inShard(root.filename().native()))
+			{
+				++otherShards;
+				continue;
+			}
+			++found;
+			callback(root);
+		}
+		else if(std::filesystem::is_directory(root))
+		{
+			const char* path = arenas[0]->store({root.native()});
+			size_t rootLength = root.native().size();
+			if(rootLength > 0 && root.native().back() != '/')
+				++rootLength;
+			directories.push_back({path, rootLength});
+		}
+	}
+
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < threadCount; ++i)
+		threads.push_back(std::thread(&Crawler::worker, this, i));
+	for(std::thread& thread : threads)
+		thread.join();
+
+	size_t arenaBytes = 0;
+	for(const std::unique_ptr<StringArena>& arena : arenas)
+		arenaBytes += arena->size();
+	Log(Log::DEBUG)<<"Crawled "<<scanned<<" directories with "<<arenaBytes<<" bytes of paths, found "<<found<<" images";
+	if(shardCount > 1)
+		Log(Log::INFO)<<"Shard "<<shardIndex<<'/'<<shardCount<<" has "<<found<<" images, "<<otherShards<<" belong to other shards";
+}
+
+size_t Crawler::filesFound() const
+{
+	return found;
+}
+
+size_t Crawler::directoriesScanned() const
+{
+	return scanned;
+}
+
+size_t Crawler::filesInOtherShards() const
+{
+	return otherShards;
+}
@@ -0,0 +1,80 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "stringarena.h"
+
+// Walks directory trees on multiple threads and hands every image it finds to a callback
+// as soon as it is discovered, so processing can start long before the walk is done.
+// Directory entry types are taken from readdir so only symlinks and file systems that
+// do not report a type need a stat call. The callback is called from the crawler threads.
+// When sharded only the images whose path relative to its root hashes to this shard are
+// reported, so instances on different machines split a dataset without talking to each other.
+class Crawler
+{
+public:
+	typedef std::function<void(const std::filesystem::path&)> Callback;
+
+private:
+	Callback callback;
+	size_t threadCount;
+	std::vector<std::unique_ptr<StringArena>> arenas;
+	struct Directory
+	{
+		const char* path;
+		// length of the root prefix, the rest of the path is what is hashed for sharding
+		size_t rootLength;
+	};
+
+	std::vector<Directory> directories;
+	size_t active = 0;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::atomic<size_t> found = 0;
+	std::atomic<size_t> scanned = 0;
+	std::atomic<size_t> otherShards = 0;
+	size_t shardIndex = 0;
+	size_t shardCount = 1;
+	bool includeArchives = false;
+
+	void worker(size_t id);
+	void scanDirectory(const Directory& directory, StringArena& arena, std::vector<Directory>& subdirectories);
+	bool inShard(const std::string_view& relativePath) const;
+
+public:
+	Crawler(Callback callback, size_t threads = 1);
+	void setShard(size_t index, size_t count);
+	// also report tar archives, they are sharded as a whole
+	void setIncludeArchives(bool include);
+	// blocks until all given files and directories have been walked
+	void crawl(const std::vector<std::filesystem::path>& roots);
+	size_t filesFound() const;
+	size_t directoriesScanned() const;
+	// images that were found but belong to a different shard
+	size_t filesInOtherShards() const;
+};
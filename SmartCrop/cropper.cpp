@@ -0,0 +1,173 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "cropper.h"
+
+#include <future>
+#include <cmath>
+#include <opencv2/imgcodecs.hpp>
+
+#include "pipeline.h"
+#include "facerecognizer.h"
+#include "log.h"
+
+static cv::Rect scaleToSource(const cv::Rect& rect, const cv::Size& base, const cv::Size& source)
+{
+	if(base.width <= 0 || base.height <= 0)
+		return rect;
+	double scaleX = static_cast<double>(source.width)/base.width;
+	double scaleY = static_cast<double>(source.height)/base.height;
+	cv::Rect scaled(std::lround(rect.x*scaleX), std::lround(rect.y*scaleY), std::lround(rect.width*scaleX), std::lround(rect.height*scaleY));
+	return scaled & cv::Rect(0, 0, source.width, source.height);
+}
+
+Cropper::Cropper(const Config& configIn): config(configIn)
+{
+	config.inMemoryOutput = true;
+	config.outputTarSize = 0;
+	config.packedOutput = false;
+	config.debug = false;
+	config.durable = false;
+	config.dedupRadius = -1;
+	config.preloadModels = true;
+	config.imagePaths.clear();
+	if(config.outputFormat.empty())
+		config.outputFormat = ".jpg";
+
+	if(!config.focusPersonImage.empty())
+	{
+		cv::Mat personImage = cv::imread(config.focusPersonImage);
+		if(personImage.empty())
+		{
+			error = "could not load image from " + config.focusPersonImage.string();
+			return;
+		}
+		try
+		{
+			recognizer = std::make_unique<FaceRecognizer>();
+			recognizer->addReferances({personImage});
+			recognizer->setThreshold(config.threshold);
+		}
+		catch(const FaceRecognizer::LoadException& ex)
+		{
+			error = ex.what();
+			recognizer.reset();
+			return;
+		}
+	}
+
+	// the pipeline loads its models on its worker threads where a failure can not be reported,
+	// so they are loaded once here first
+	if(!Pipeline::checkModels(config, error))
+	{
+		recognizer.reset();
+		return;
+	}
+
+	pipeline = std::make_unique<Pipeline>(config, recognizer.get(), std::filesystem::path());
+	pipeline->setResultCallback([this](const ImageJob& job, bool ok){storeResult(job, ok);});
+	pipeline->setCompletionCallback([this](const std::filesystem::path& path, bool ok){complete(path.string(), ok);});
+}
+
+Cropper::~Cropper()
+{
+	if(pipeline)
+		pipeline->finish();
+}
+
+bool Cropper::isOpen() const
+{
+	return pipeline != nullptr;
+}
+
+const std::string& Cropper::getError() const
+{
+	return error;
+}
+
+void Cropper::storeResult(const ImageJob& job, bool ok)
+{
+	Result result;
+	result.sourceSize = job.sourceSize;
+	result.stageTimes = job.stageTimes;
+	for(Yolo::Detection detection : job.detections)
+	{
+		detection.box = scaleToSource(detection.box, job.analysisSize, job.sourceSize);
+		result.detections.push_back(detection);
+	}
+	for(const ImageOutput& imageOutput : job.outputs)
+	{
+		Output output;
+		output.size = imageOutput.size;
+		output.crop = scaleToSource(imageOutput.crop, imageOutput.cropBase, job.sourceSize);
+		output.incompleate = imageOutput.incompleate;
+		output.seamCarved = imageOutput.seamCarved;
+		output.image = imageOutput.image;
+		output.encoded = imageOutput.encoded;
+		result.outputs.push_back(std::move(output));
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto search = pending.find(job.path.string());
+	if(search != pending.end())
+		search->second.result = std::move(result);
+}
+
+void Cropper::complete(const std::string& name, bool ok)
+{
+	Pending done;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto search = pending.find(name);
+		if(search == pending.end())
+			return;
+		done = std::move(search->second);
+		pending.erase(search);
+	}
+	done.result.ok = ok && !done.result.outputs.empty();
+	if(done.callback)
+		done.callback(done.result);
+}
+
+void Cropper::submit(std::vector<unsigned char>&& data, Callback callback, std::shared_ptr<const ImageOptions> options)
+{
+	if(!pipeline)
+	{
+		Result result;
+		callback(result);
+		return;
+	}
+
+	// the name only has to be unique, the outputs are encoded in config.outputFormat regardless of it
+	std::string name = std::to_string(nextId++);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending[name].callback = callback;
+	}
+	pipeline->push(name, std::move(data), 0, std::move(options));
+}
+
+Cropper::Result Cropper::process(const unsigned char* data, size_t size, std::shared_ptr<const ImageOptions> options)
+{
+	std::promise<Result> promise;
+	std::future<Result> future = promise.get_future();
+	submit(std::vector<unsigned char>(data, data+size), [&promise](Result& result){promise.set_value(std::move(result));}, std::move(options));
+	return future.get();
+}
@@ -0,0 +1,103 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <array>
+#include <chrono>
+#include <unordered_map>
+#include <opencv2/core.hpp>
+
+#include "config.h"
+#include "yolo.h"
+
+class Pipeline;
+class FaceRecognizer;
+struct ImageJob;
+
+// Crops images held in memory with models that stay loaded for the lifetime of the object.
+// Images are processed by an internal pipeline, so submit() can be called from any number of
+// threads and the images are worked on concurrently. Rectangles in results are in the
+// coordinates of the source image.
+class Cropper
+{
+public:
+	struct Output
+	{
+		cv::Size size;
+		cv::Rect crop;
+		bool incompleate = false;
+		// the crop is a rectangle of the seam carved image and only approximately one of the source
+		bool seamCarved = false;
+		cv::Mat image;
+		// image encoded in the configured outputFormat
+		std::vector<unsigned char> encoded;
+	};
+
+	struct Result
+	{
+		bool ok = false;
+		cv::Size sourceSize;
+		std::vector<Yolo::Detection> detections;
+		std::vector<Output> outputs;
+		// time spent in the decode, detect, crop and encode stages
+		std::array<std::chrono::duration<double>, 4> stageTimes = {};
+	};
+
+	typedef std::function<void(Result& result)> Callback;
+
+private:
+	struct Pending
+	{
+		Result result;
+		Callback callback;
+	};
+
+	Config config;
+	std::unique_ptr<FaceRecognizer> recognizer;
+	std::unique_ptr<Pipeline> pipeline;
+	std::mutex mutex;
+	std::unordered_map<std::string, Pending> pending;
+	std::atomic<uint64_t> nextId = 0;
+	std::string error;
+
+	void storeResult(const ImageJob& job, bool ok);
+	void complete(const std::string& name, bool ok);
+
+public:
+	// the file output, journal, debug and deduplication settings of config are ignored, outputs are
+	// encoded as jpeg unless config.outputFormat is set
+	explicit Cropper(const Config& config);
+	~Cropper();
+	Cropper(const Cropper&) = delete;
+	Cropper& operator=(const Cropper&) = delete;
+	bool isOpen() const;
+	const std::string& getError() const;
+	// queues the encoded image, callback is called from a worker thread once it is done,
+	// options replace the target sizes, seam carving and output format of the config for this image
+	void submit(std::vector<unsigned char>&& data, Callback callback, std::shared_ptr<const ImageOptions> options = nullptr);
+	// crops the encoded image and waits for the result
+	Result process(const unsigned char* data, size_t size, std::shared_ptr<const ImageOptions> options = nullptr);
+};
@@ -0,0 +1,294 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "daemon.h"
+
+#include <atomic>
+#include <future>
+#include <sstream>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <opencv2/imgcodecs.hpp>
+
+#include "socketio.h"
+#include "tokenize.h"
+#include "imageloader.h"
+#include "log.h"
+
+// limits on what a client can make the daemon hold, requests beyond them close the connection
+static constexpr size_t maxDataSize = size_t(64)*1024*1024;
+static constexpr size_t maxLineLength = 64*1024;
+static constexpr size_t maxClients = 64;
+
+static std::atomic<bool> stopRequested = false;
+
+static void requestStop(int signal)
+{
+	(void)signal;
+	stopRequested = true;
+}
+
+static bool parseSizes(const std::string& str, std::vector<cv::Size>& sizes)
+{
+	try
+	{
+		for(const std::string& token : tokenizeBinaryIgnore(str, ','))
+		{
+			std::vector<std::string> dimensions = tokenizeBinaryIgnore(token, 'x');
+			if(dimensions.size() != 2)
+				return false;
+			cv::Size size(std::stoi(dimensions[0]), std::stoi(dimensions[1]));
+			if(size.width < 1 || size.height < 1)
+				return false;
+			sizes.push_back(size);
+		}
+	}
+	catch(const std::logic_error& err)
+	{
+		return false;
+	}
+	return !sizes.empty();
+}
+
+static bool parseFlags(const std::string& str, ImageOptions& options, bool& returnImage)
+{
+	for(const std::string& flag : tokenizeBinaryIgnore(str, ','))
+	{
+		if(flag == "image")
+			returnImage = true;
+		else if(flag == "seam")
+			options.seamCarving = true;
+		else if(flag == "noseam")
+			options.seamCarving = false;
+		else if(flag.size() > 1 && flag[0] == '.')
+			options.outputFormat = flag;
+		else if(flag != "-")
+			return false;
+	}
+	return true;
+}
+
+static bool sendError(int fd, const std::string& message)
+{
+	return writeAll(fd, "ERROR " + message + '\n');
+}
+
+Daemon::Daemon(const Config& configIn, const std::filesystem::path& socketPathIn):
+	config(configIn), cropper(configIn), socketPath(socketPathIn)
+{
+	if(!cropper.isOpen())
+	{
+		Log(Log::ERROR)<<cropper.getError();
+		return;
+	}
+	warmUp();
+	listenFd = listenUnix(socketPath);
+	if(listenFd >= 0)
+		Log(Log::INFO)<<"Serving crop requests on "<<socketPath;
+}
+
+Daemon::~Daemon()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(Client& client : clients)
+		{
+			if(!client.done)
+				shutdown(client.fd, SHUT_RDWR);
+		}
+	}
+	for(Client& client : clients)
+		client.thread.join();
+	if(listenFd >= 0)
+	{
+		close(listenFd);
+		unlink(socketPath.c_str());
+	}
+}
+
+bool Daemon::isOpen() const
+{
+	return listenFd >= 0;
+}
+
+void Daemon::warmUp()
+{
+	// the first inference of every model instance is several times slower than the following ones,
+	// so this is paid before the first client can connect
+	std::vector<unsigned char> blank;
+	cv::imencode(".png", cv::Mat(64, 64, CV_8UC3, cv::Scalar(0, 0, 0)), blank);
+	std::vector<std::future<Cropper::Result>> results;
+	for(size_t i = 0; i < config.detectThreads; ++i)
+	{
+		results.push_back(std::async(std::launch::async, [this, &blank]()
+		{
+			return cropper.process(blank.data(), blank.size());
+		}));
+	}
+	for(std::future<Cropper::Result>& result : results)
+		result.wait();
+}
+
+bool Daemon::handleRequest(int fd, LineReader& reader, const std::string& line)
+{
+	std::istringstream stream(line);
+	std::string command;
+	std::string sizes;
+	std::string flags;
+	stream>>command>>sizes>>flags;
+	std::string argument;
+	std::getline(stream>>std::ws, argument);
+
+	std::shared_ptr<ImageOptions> options = std::make_shared<ImageOptions>();
+	options->seamCarving = config.seamCarving;
+	bool returnImage = false;
+	bool sizesValid = parseSizes(sizes, options->targetSizes);
+	bool flagsValid = parseFlags(flags, *options, returnImage);
+
+	std::vector<unsigned char> data;
+	if(command == "DATA")
+	{
+		size_t length;
+		try
+		{
+			length = std::stoull(argument);
+		}
+		catch(const std::logic_error& err)
+		{
+			sendError(fd, "invalid length");
+			return false;
+		}
+		if(length > maxDataSize)
+		{
+			sendError(fd, "image too large");
+			return false;
+		}
+		// the image has to be consumed even if the request is invalid to stay in sync with the client
+		if(!reader.read(data, length))
+			return false;
+	}
+	else if(command != "CROP")
+	{
+		return sendError(fd, "unknown command " + command);
+	}
+
+	if(!sizesValid)
+		return sendError(fd, "invalid sizes " + sizes);
+	if(!flagsValid)
+		return sendError(fd, "invalid flags " + flags);
+
+	if(command == "CROP")
+	{
+		std::filesystem::path path = unescapeSeperators(argument);
+		if(!readFileData(path, data))
+			return sendError(fd, "could not read " + path.string());
+	}
+
+	Cropper::Result result = cropper.process(data.data(), data.size(), options);
+	if(!result.ok)
+		return sendError(fd, "could not process image");
+
+	std::ostringstream header;
+	header<<"OK "<<result.sourceSize.width<<'x'<<result.sourceSize.height<<' '<<result.outputs.size()<<'\n';
+	if(!writeAll(fd, header.str()))
+		return false;
+	for(const Cropper::Output& output : result.outputs)
+	{
+		size_t length = returnImage ? output.encoded.size() : 0;
+		std::ostringstream outputLine;
+		outputLine<<output.size.width<<'x'<<output.size.height<<' '<<output.crop.x<<' '<<output.crop.y<<' '
+			<<output.crop.width<<' '<<output.crop.height<<' '<<output.seamCarved<<' '<<output.incompleate<<' '<<length<<'\n';
+		if(!writeAll(fd, outputLine.str()) || !writeAll(fd, output.encoded.data(), length))
+			return false;
+	}
+	return true;
+}
+
+void Daemon::handleClient(Client* client)
+{
+	LineReader reader(client->fd, maxLineLength);
+	std::string line;
+	while(reader.readLine(line))
+	{
+		if(line.empty())
+			continue;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if(!handleRequest(client->fd, reader, line))
+			break;
+		std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+		Log(Log::DEBUG)<<"Served request in "<<duration.count()<<"ms";
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	close(client->fd);
+	client->done = true;
+}
+
+void Daemon::reapClients()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for(std::list<Client>::iterator it = clients.begin(); it != clients.end();)
+	{
+		if(it->done)
+		{
+			it->thread.join();
+			it = clients.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void Daemon::run()
+{
+	std::signal(SIGINT, requestStop);
+	std::signal(SIGTERM, requestStop);
+
+	while(!stopRequested)
+	{
+		reapClients();
+
+		struct pollfd pfd = {listenFd, POLLIN, 0};
+		if(poll(&pfd, 1, 1000) <= 0)
+			continue;
+		int fd = accept(listenFd, nullptr, nullptr);
+		if(fd < 0)
+			continue;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if(clients.size() >= maxClients)
+		{
+			Log(Log::WARN)<<"Refusing client, "<<maxClients<<" are already connected";
+			sendError(fd, "too many clients");
+			close(fd);
+			continue;
+		}
+		clients.emplace_back();
+		Client* client = &clients.back();
+		client->fd = fd;
+		client->thread = std::thread(&Daemon::handleClient, this, client);
+		Log(Log::DEBUG)<<"Client connected";
+	}
+	Log(Log::INFO)<<"Stopping";
+}
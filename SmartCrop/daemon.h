@@ -0,0 +1,76 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <list>
+#include <mutex>
+#include <thread>
+
+#include "config.h"
+#include "cropper.h"
+
+class LineReader;
+
+// Serves crop requests from other processes over a UNIX socket, the models stay loaded between requests.
+//
+// The protocol is line based like the one of WorkServer, sizes are comma seperated lists of WIDTHxHEIGHT:
+//   client: CROP <sizes> <flags> <path>      crop the image file at path, escaped with escapeSeperators()
+//   client: DATA <sizes> <flags> <length>    crop the encoded image in the length bytes following the line
+//   daemon: OK <width>x<height> <count>      the size of the source image followed by count output lines of
+//           <width>x<height> <x> <y> <w> <h> <seamCarved> <incompleate> <length>
+//           each followed by length bytes of the encoded output, length is 0 unless the image was requested
+//   daemon: ERROR <message>
+// flags is a comma seperated list of: image to return the encoded outputs, seam or noseam to override
+// whether seam carving is used, an extension like .png for the output format, or - for none.
+// The crop rectangles are in the coordinates of the source image. Requests on a connection are
+// answered in order, connections are served concurrently. Inline images are limited to 64MiB,
+// lines to 64KiB and the number of connected clients to 64.
+class Daemon
+{
+private:
+	struct Client
+	{
+		int fd;
+		std::thread thread;
+		bool done = false;
+	};
+
+	const Config& config;
+	Cropper cropper;
+	std::filesystem::path socketPath;
+	int listenFd = -1;
+	std::mutex mutex;
+	std::list<Client> clients;
+
+	void handleClient(Client* client);
+	// returns false if the connection has to be closed
+	bool handleRequest(int fd, LineReader& reader, const std::string& line);
+	void reapClients();
+	void warmUp();
+
+public:
+	Daemon(const Config& config, const std::filesystem::path& socketPath);
+	~Daemon();
+	bool isOpen() const;
+	// serves clients until SIGINT or SIGTERM is received
+	void run();
+};
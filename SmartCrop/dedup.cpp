@@ -0,0 +1,128 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "dedup.h"
+
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+
+Deduplicator::Deduplicator(int radiusIn): radius(radiusIn)
+{
+}
+
+bool Deduplicator::findExact(uint64_t contentHash, size_t size, std::filesystem::path& duplicateOf)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto search = exact.find(ExactKey{contentHash, size});
+	if(search == exact.end())
+		return false;
+	duplicateOf = paths[search->second];
+	return true;
+}
+
+bool Deduplicator::findSimilar(uint64_t perceptualHash, std::filesystem::path& duplicateOf)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if(nodes.empty())
+		return false;
+
+	std::vector<size_t> stack = {0};
+	while(!stack.empty())
+	{
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+		int nodeDistance = distance(node.hash, perceptualHash);
+		if(nodeDistance <= radius)
+		{
+			duplicateOf = paths[node.path];
+			return true;
+		}
+		// by the triangle inequality only children this close to the node can be within radius
+		for(const std::pair<int, size_t>& child : node.children)
+		{
+			if(child.first >= nodeDistance - radius && child.first <= nodeDistance + radius)
+				stack.push_back(child.second);
+		}
+	}
+	return false;
+}
+
+void Deduplicator::add(const std::filesystem::path& path, uint64_t contentHash, size_t size, uint64_t perceptualHash)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t pathIndex = paths.size();
+	paths.push_back(path);
+	exact.try_emplace(ExactKey{contentHash, size}, pathIndex);
+
+	if(nodes.empty())
+	{
+		nodes.push_back({perceptualHash, pathIndex, {}});
+		return;
+	}
+
+	size_t current = 0;
+	while(true)
+	{
+		int nodeDistance = distance(nodes[current].hash, perceptualHash);
+		auto child = std::find_if(nodes[current].children.begin(), nodes[current].children.end(),
+			[nodeDistance](const std::pair<int, size_t>& child){return child.first == nodeDistance;});
+		if(child == nodes[current].children.end())
+		{
+			nodes[current].children.push_back({nodeDistance, nodes.size()});
+			nodes.push_back({perceptualHash, pathIndex, {}});
+			return;
+		}
+		current = child->second;
+	}
+}
+
+size_t Deduplicator::size()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return paths.size();
+}
+
+uint64_t Deduplicator::perceptualHash(const cv::Mat& image)
+{
+	cv::Mat gray;
+	if(image.channels() == 3)
+		cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+	else if(image.channels() == 4)
+		cv::cvtColor(image, gray, cv::COLOR_BGRA2GRAY);
+	else
+		gray = image;
+
+	cv::Mat small;
+	cv::resize(gray, small, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+
+	uint64_t hash = 0;
+	for(int y = 0; y < small.rows; ++y)
+	{
+		const uint8_t* row = small.ptr<uint8_t>(y);
+		for(int x = 0; x < small.cols-1; ++x)
+			hash = (hash << 1) | (row[x] < row[x+1]);
+	}
+	return hash;
+}
+
+int Deduplicator::distance(uint64_t a, uint64_t b)
+{
+	return __builtin_popcountll(a ^ b);
+}
@@ -0,0 +1,81 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+// Finds images that where already seen, either as exact copies by size and content hash or as
+// near duplicates like resized or recompressed versions by the hamming distance of a 64 bit
+// difference hash. The perceptual hashes are kept in a BK-tree so lookups only visit the part
+// of the tree within the radius. Images are only recorded by add(), which the pipeline calls once
+// their output is committed, so the duplicates of an image that fails are still processed. Of a
+// set of duplicates the first one committed is kept, copies in flight at the same time are all kept.
+class Deduplicator
+{
+private:
+	struct ExactKey
+	{
+		uint64_t contentHash;
+		size_t size;
+		bool operator==(const ExactKey& other) const
+		{
+			return contentHash == other.contentHash && size == other.size;
+		}
+	};
+
+	struct ExactKeyHash
+	{
+		size_t operator()(const ExactKey& key) const
+		{
+			return key.contentHash ^ key.size;
+		}
+	};
+
+	struct Node
+	{
+		uint64_t hash;
+		size_t path;
+		// distance to this node and index of the child node
+		std::vector<std::pair<int, size_t>> children;
+	};
+
+	int radius;
+	std::mutex mutex;
+	std::vector<std::filesystem::path> paths;
+	std::unordered_map<ExactKey, size_t, ExactKeyHash> exact;
+	std::vector<Node> nodes;
+
+public:
+	// images within radius bits of hamming distance are considered duplicates
+	explicit Deduplicator(int radius);
+	bool findExact(uint64_t contentHash, size_t size, std::filesystem::path& duplicateOf);
+	bool findSimilar(uint64_t perceptualHash, std::filesystem::path& duplicateOf);
+	void add(const std::filesystem::path& path, uint64_t contentHash, size_t size, uint64_t perceptualHash);
+	size_t size();
+
+	// difference hash of the image, works on any size down to 9x8 pixels
+	static uint64_t perceptualHash(const cv::Mat& image);
+	static int distance(uint64_t a, uint64_t b);
+};
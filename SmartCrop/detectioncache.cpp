@@ -0,0 +1,354 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "detectioncache.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// data file:  magic(4) version(4) then records of size(4) key(20) count(2) entries(count*28)
+// index file: magic(4) version(4) dataSize(8) then entries of key(20) offset(8)
+// all values are stored in host byte order
+
+template<typename T>
+static void put(unsigned char*& buffer, T value)
+{
+	std::memcpy(buffer, &value, sizeof(T));
+	buffer += sizeof(T);
+}
+
+template<typename T>
+static T get(const unsigned char*& buffer)
+{
+	T value;
+	std::memcpy(&value, buffer, sizeof(T));
+	buffer += sizeof(T);
+	return value;
+}
+
+static bool readAll(int fd, void* buffer, size_t size, uint64_t offset)
+{
+	unsigned char* bytes = static_cast<unsigned char*>(buffer);
+	while(size > 0)
+	{
+		ssize_t ret = pread(fd, bytes, size, offset);
+		if(ret <= 0)
+			return false;
+		bytes += ret;
+		size -= ret;
+		offset += ret;
+	}
+	return true;
+}
+
+static bool writeAll(int fd, const void* buffer, size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(buffer);
+	while(size > 0)
+	{
+		ssize_t ret = write(fd, bytes, size);
+		if(ret <= 0)
+			return false;
+		bytes += ret;
+		size -= ret;
+	}
+	return true;
+}
+
+DetectionCache::DetectionCache(const std::filesystem::path& pathIn): path(pathIn)
+{
+	indexPath = path;
+	indexPath += ".idx";
+
+	fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if(fd < 0)
+	{
+		Log(Log::ERROR)<<"could not open detection cache "<<path;
+		return;
+	}
+
+	off_t size = lseek(fd, 0, SEEK_END);
+	if(size == 0)
+	{
+		unsigned char header[fileHeaderSize];
+		unsigned char* ptr = header;
+		put<uint32_t>(ptr, dataMagic);
+		put<uint32_t>(ptr, version);
+		if(!writeAll(fd, header, sizeof(header)))
+		{
+			Log(Log::ERROR)<<"could not write to detection cache "<<path;
+			close(fd);
+			fd = -1;
+			return;
+		}
+		dataSize = fileHeaderSize;
+		return;
+	}
+
+	unsigned char header[fileHeaderSize];
+	const unsigned char* ptr = header;
+	if(size < static_cast<off_t>(fileHeaderSize) || !readAll(fd, header, sizeof(header), 0) ||
+		get<uint32_t>(ptr) != dataMagic || get<uint32_t>(ptr) != version)
+	{
+		Log(Log::ERROR)<<path<<" is not a detection cache of a compatible version";
+		close(fd);
+		fd = -1;
+		return;
+	}
+	dataSize = size;
+
+	if(!loadIndex())
+		scanData(fileHeaderSize);
+	Log(Log::INFO)<<"Loaded "<<index.size()<<" cached detection results from "<<path;
+}
+
+DetectionCache::~DetectionCache()
+{
+	if(fd < 0)
+		return;
+	if(!writeIndex())
+		Log(Log::WARN)<<"could not write detection cache index "<<indexPath;
+	close(fd);
+	Log(Log::INFO)<<"Detection cache: "<<hits<<" hits, "<<misses<<" misses";
+}
+
+bool DetectionCache::isOpen() const
+{
+	return fd >= 0;
+}
+
+void DetectionCache::writeKey(unsigned char* buffer, const Key& key)
+{
+	put<uint64_t>(buffer, key.contentHash);
+	put<uint64_t>(buffer, key.modelHash);
+	put<uint16_t>(buffer, key.width);
+	put<uint16_t>(buffer, key.height);
+}
+
+DetectionCache::Key DetectionCache::readKey(const unsigned char* buffer)
+{
+	Key key;
+	key.contentHash = get<uint64_t>(buffer);
+	key.modelHash = get<uint64_t>(buffer);
+	key.width = get<uint16_t>(buffer);
+	key.height = get<uint16_t>(buffer);
+	return key;
+}
+
+bool DetectionCache::loadIndex()
+{
+	int indexFd = open(indexPath.c_str(), O_RDONLY);
+	if(indexFd < 0)
+		return false;
+
+	off_t size = lseek(indexFd, 0, SEEK_END);
+	unsigned char header[16];
+	const unsigned char* ptr = header;
+	if(size < 16 || (size-16) % indexEntrySize != 0 || !readAll(indexFd, header, sizeof(header), 0) ||
+		get<uint32_t>(ptr) != indexMagic || get<uint32_t>(ptr) != version)
+	{
+		Log(Log::WARN)<<"ignoring invalid detection cache index "<<indexPath;
+		close(indexFd);
+		return false;
+	}
+
+	uint64_t indexedSize = get<uint64_t>(ptr);
+	if(indexedSize > dataSize)
+	{
+		Log(Log::WARN)<<"detection cache index "<<indexPath<<" dose not match its data file";
+		close(indexFd);
+		return false;
+	}
+
+	std::vector<unsigned char> entries(size-16);
+	bool ret = readAll(indexFd, entries.data(), entries.size(), 16);
+	close(indexFd);
+	if(!ret)
+		return false;
+
+	for(size_t offset = 0; offset < entries.size(); offset += indexEntrySize)
+	{
+		const unsigned char* entry = entries.data()+offset;
+		Key key = readKey(entry);
+		entry += keySize;
+		index[key] = get<uint64_t>(entry);
+	}
+
+	// records appended after the index was written
+	if(indexedSize < dataSize)
+		scanData(indexedSize);
+	return true;
+}
+
+void DetectionCache::scanData(uint64_t offset)
+{
+	while(offset + 4 + keySize + 2 <= dataSize)
+	{
+		unsigned char header[4 + keySize];
+		if(!readAll(fd, header, sizeof(header), offset))
+			break;
+		const unsigned char* ptr = header;
+		uint32_t recordSize = get<uint32_t>(ptr);
+		if(recordSize < 4 + keySize + 2 || offset + recordSize > dataSize)
+			break;
+		index[readKey(ptr)] = offset;
+		offset += recordSize;
+	}
+
+	// drop a record that was only partially written when a previous run was interrupted
+	if(offset < dataSize)
+	{
+		Log(Log::WARN)<<"truncating "<<dataSize-offset<<" bytes of incomplete records from "<<path;
+		if(ftruncate(fd, offset) == 0)
+			dataSize = offset;
+	}
+}
+
+bool DetectionCache::writeIndex()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::filesystem::path tmpPath = indexPath;
+	tmpPath += ".tmp";
+
+	std::vector<unsigned char> buffer(16 + index.size()*indexEntrySize);
+	unsigned char* ptr = buffer.data();
+	put<uint32_t>(ptr, indexMagic);
+	put<uint32_t>(ptr, version);
+	put<uint64_t>(ptr, dataSize);
+	for(const std::pair<const Key, uint64_t>& entry : index)
+	{
+		writeKey(ptr, entry.first);
+		ptr += keySize;
+		put<uint64_t>(ptr, entry.second);
+	}
+
+	int indexFd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(indexFd < 0)
+		return false;
+	bool ret = writeAll(indexFd, buffer.data(), buffer.size());
+	ret = close(indexFd) == 0 && ret;
+	if(!ret)
+		return false;
+
+	std::error_code ec;
+	std::filesystem::rename(tmpPath, indexPath, ec);
+	return !ec;
+}
+
+bool DetectionCache::lookup(const Key& key, std::vector<Entry>& entries)
+{
+	uint64_t offset;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto search = index.find(key);
+		if(search == index.end())
+		{
+			++misses;
+			return false;
+		}
+		offset = search->second;
+	}
+
+	unsigned char header[4 + keySize + 2];
+	if(!readAll(fd, header, sizeof(header), offset))
+		return false;
+	const unsigned char* ptr = header;
+	uint32_t recordSize = get<uint32_t>(ptr);
+	ptr += keySize;
+	uint16_t count = get<uint16_t>(ptr);
+	if(recordSize != sizeof(header) + count*entrySize)
+	{
+		Log(Log::WARN)<<"corrupted record in detection cache "<<path;
+		++misses;
+		return false;
+	}
+
+	std::vector<unsigned char> buffer(count*entrySize);
+	if(!readAll(fd, buffer.data(), buffer.size(), offset+sizeof(header)))
+		return false;
+
+	entries.clear();
+	entries.reserve(count);
+	ptr = buffer.data();
+	for(uint16_t i = 0; i < count; ++i)
+	{
+		Entry entry;
+		entry.classId = get<uint16_t>(ptr);
+		entry.person = get<int16_t>(ptr);
+		entry.confidence = get<float>(ptr);
+		entry.personConfidence = get<float>(ptr);
+		entry.box.x = get<float>(ptr);
+		entry.box.y = get<float>(ptr);
+		entry.box.width = get<float>(ptr);
+		entry.box.height = get<float>(ptr);
+		entries.push_back(entry);
+	}
+	++hits;
+	return true;
+}
+
+bool DetectionCache::store(const Key& key, const std::vector<Entry>& entries)
+{
+	if(fd < 0 || entries.size() > UINT16_MAX)
+		return false;
+
+	std::vector<unsigned char> buffer(4 + keySize + 2 + entries.size()*entrySize);
+	unsigned char* ptr = buffer.data();
+	put<uint32_t>(ptr, buffer.size());
+	writeKey(ptr, key);
+	ptr += keySize;
+	put<uint16_t>(ptr, entries.size());
+	for(const Entry& entry : entries)
+	{
+		put<uint16_t>(ptr, entry.classId);
+		put<int16_t>(ptr, entry.person);
+		put<float>(ptr, entry.confidence);
+		put<float>(ptr, entry.personConfidence);
+		put<float>(ptr, entry.box.x);
+		put<float>(ptr, entry.box.y);
+		put<float>(ptr, entry.box.width);
+		put<float>(ptr, entry.box.height);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if(!writeAll(fd, buffer.data(), buffer.size()))
+	{
+		Log(Log::WARN)<<"could not write to detection cache "<<path;
+		if(ftruncate(fd, dataSize) != 0)
+			Log(Log::WARN)<<"could not remove partial record from "<<path;
+		return false;
+	}
+	index[key] = dataSize;
+	dataSize += buffer.size();
+	return true;
+}
+
+size_t DetectionCache::getHits() const
+{
+	return hits;
+}
+
+size_t DetectionCache::getMisses() const
+{
+	return misses;
+}
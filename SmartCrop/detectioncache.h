@@ -0,0 +1,99 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <opencv2/core/types.hpp>
+
+// On disk cache of detection results. Records are appended to a data file, an index
+// of key to record offset is kept in a side file that is rewritten when the cache is closed.
+// Records appended after the index was last written are recovered by scanning the data file.
+class DetectionCache
+{
+public:
+	struct Key
+	{
+		uint64_t contentHash = 0;
+		uint64_t modelHash = 0;
+		uint16_t width = 0;
+		uint16_t height = 0;
+
+		bool operator==(const Key& other) const
+		{
+			return contentHash == other.contentHash && modelHash == other.modelHash && width == other.width && height == other.height;
+		}
+	};
+
+	struct Entry
+	{
+		int classId = 0;
+		float confidence = 0;
+		// normalized to the size of the image the detection was run on
+		cv::Rect2f box;
+		int person = -1;
+		float personConfidence = 0;
+	};
+
+private:
+	struct KeyHasher
+	{
+		size_t operator()(const Key& key) const
+		{
+			return key.contentHash ^ (key.modelHash*0x9E3779B97F4A7C15ULL) ^ (static_cast<size_t>(key.width) << 16 | key.height);
+		}
+	};
+
+	static constexpr uint32_t dataMagic = 0x43444353; // "SCDC"
+	static constexpr uint32_t indexMagic = 0x49444353; // "SCDI"
+	static constexpr uint32_t version = 1;
+	static constexpr size_t fileHeaderSize = 8;
+	static constexpr size_t keySize = 20;
+	static constexpr size_t entrySize = 28;
+	static constexpr size_t indexEntrySize = keySize + 8;
+
+	std::filesystem::path path;
+	std::filesystem::path indexPath;
+	int fd = -1;
+	uint64_t dataSize = 0;
+	std::unordered_map<Key, uint64_t, KeyHasher> index;
+	std::mutex mutex;
+	std::atomic<size_t> hits = 0;
+	std::atomic<size_t> misses = 0;
+
+	static void writeKey(unsigned char* buffer, const Key& key);
+	static Key readKey(const unsigned char* buffer);
+	bool loadIndex();
+	void scanData(uint64_t offset);
+	bool writeIndex();
+
+public:
+	DetectionCache(const std::filesystem::path& path);
+	~DetectionCache();
+	bool isOpen() const;
+	bool lookup(const Key& key, std::vector<Entry>& entries);
+	bool store(const Key& key, const std::vector<Entry>& entries);
+	size_t getHits() const;
+	size_t getMisses() const;
+};
@@ -0,0 +1,155 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "filewriter.h"
+
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "log.h"
+
+FileWriter::FileWriter(const std::filesystem::path& directory, size_t syncIntervalIn, std::chrono::seconds maxDelayIn):
+	syncInterval(syncIntervalIn), maxDelay(maxDelayIn), lastSync(std::chrono::steady_clock::now())
+{
+	if(syncInterval > 0)
+	{
+		syncFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if(syncFd < 0)
+		{
+			Log(Log::WARN)<<"could not open "<<directory<<" for syncing, outputs will not be synced: "<<std::strerror(errno);
+			syncInterval = 0;
+		}
+	}
+	if(syncInterval > 0)
+		flusher = std::thread(&FileWriter::flushLoop, this);
+}
+
+FileWriter::~FileWriter()
+{
+	if(flusher.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		pendingCondition.notify_all();
+		flusher.join();
+	}
+	flush();
+	if(syncFd >= 0)
+		close(syncFd);
+}
+
+bool FileWriter::write(const std::filesystem::path& path, const std::vector<unsigned char>& data)
+{
+	std::filesystem::path tmpPath = path.parent_path()/("." + path.filename().string() + ".tmp");
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0)
+		return false;
+
+	size_t written = 0;
+	while(written < data.size())
+	{
+		ssize_t ret = ::write(fd, data.data()+written, data.size()-written);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		written += ret;
+	}
+
+	if(close(fd) != 0 || written != data.size() || rename(tmpPath.c_str(), path.c_str()) != 0)
+	{
+		unlink(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+void FileWriter::commit(std::function<void()> action)
+{
+	if(syncInterval == 0)
+	{
+		action();
+		return;
+	}
+
+	bool due;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.push_back(std::move(action));
+		due = pending.size() >= syncInterval || std::chrono::steady_clock::now() - lastSync > maxDelay;
+	}
+	if(due)
+		flush();
+	else
+		pendingCondition.notify_all();
+}
+
+void FileWriter::flushLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while(!stopping)
+	{
+		if(pending.empty())
+		{
+			pendingCondition.wait(lock);
+			continue;
+		}
+		std::chrono::steady_clock::time_point due = lastSync + maxDelay;
+		if(std::chrono::steady_clock::now() < due)
+		{
+			pendingCondition.wait_until(lock, due);
+			continue;
+		}
+		lock.unlock();
+		flush();
+		lock.lock();
+	}
+}
+
+void FileWriter::flush()
+{
+	std::vector<std::function<void()>> actions;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		actions.swap(pending);
+		lastSync = std::chrono::steady_clock::now();
+	}
+	if(actions.empty())
+		return;
+
+	// everything the actions depend on was written before they where queued, so one syncfs covers all of them
+	if(syncfs(syncFd) != 0)
+		Log(Log::WARN)<<"syncfs failed: "<<std::strerror(errno);
+	++syncs;
+	for(std::function<void()>& action : actions)
+		action();
+}
+
+size_t FileWriter::syncCount() const
+{
+	return syncs;
+}
@@ -0,0 +1,62 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+// Writes files atomically by writing a temporary file next to the destination and renaming it
+// into place, so readers never see a partially written output. When durable, writes are made
+// durable in batches with syncfs instead of an fsync per file, and the actions passed to commit()
+// only run once everything written before them has reached the disk, at the latest maxDelay after
+// the oldest of them was queued.
+class FileWriter
+{
+private:
+	int syncFd = -1;
+	size_t syncInterval;
+	std::chrono::seconds maxDelay;
+	std::mutex mutex;
+	std::vector<std::function<void()>> pending;
+	std::chrono::steady_clock::time_point lastSync;
+	std::atomic<size_t> syncs = 0;
+	std::condition_variable pendingCondition;
+	bool stopping = false;
+	// flushes pending commits once maxDelay has passed even if no further commits arrive
+	std::thread flusher;
+
+	void flushLoop();
+
+public:
+	// syncInterval is the number of commits between syncs, 0 disables durability
+	FileWriter(const std::filesystem::path& directory, size_t syncInterval, std::chrono::seconds maxDelay = std::chrono::seconds(5));
+	~FileWriter();
+	bool write(const std::filesystem::path& path, const std::vector<unsigned char>& data);
+	void commit(std::function<void()> action);
+	// syncs and runs all pending commits
+	void flush();
+	size_t syncCount() const;
+};
@@ -0,0 +1,87 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "hash.h"
+
+#include <cstring>
+
+static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t finalize(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t lanes[4] = {seed + prime1, seed + prime2, seed, seed - prime1};
+
+	size_t pos = 0;
+	for(; pos + 32 <= size; pos += 32)
+	{
+		for(size_t i = 0; i < 4; ++i)
+		{
+			uint64_t word;
+			std::memcpy(&word, bytes+pos+i*8, sizeof(word));
+			lanes[i] = rotl(lanes[i] + word*prime2, 31)*prime1;
+		}
+	}
+
+	uint64_t h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18) + size;
+	for(; pos + 8 <= size; pos += 8)
+	{
+		uint64_t word;
+		std::memcpy(&word, bytes+pos, sizeof(word));
+		h = rotl(h ^ (rotl(word*prime2, 31)*prime1), 27)*prime1 + prime2;
+	}
+	for(; pos < size; ++pos)
+		h = rotl(h ^ (bytes[pos]*prime1), 11)*prime2;
+
+	return finalize(h);
+}
+
+uint64_t hashString(const std::string& str, uint64_t seed)
+{
+	return hashBytes(str.data(), str.size(), seed);
+}
+
+std::string hashToString(uint64_t hash)
+{
+	static constexpr char digits[] = "0123456789abcdef";
+	std::string out(16, '0');
+	for(int i = 15; i >= 0; --i)
+	{
+		out[i] = digits[hash & 0xF];
+		hash >>= 4;
+	}
+	return out;
+}
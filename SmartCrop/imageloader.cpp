@@ -0,0 +1,245 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "imageloader.h"
+
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <opencv2/imgcodecs.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+
+bool readFileData(const std::filesystem::path& path, std::vector<unsigned char>& data)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if(!file.is_open())
+		return false;
+	std::streamsize size = file.tellg();
+	if(size < 0)
+		return false;
+	file.seekg(0, std::ios::beg);
+	data.resize(size);
+	return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), size));
+}
+
+MappedFile::MappedFile(const std::filesystem::path& path, bool dropCacheIn): dropCache(dropCacheIn)
+{
+	fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size <= 0)
+		return;
+	length = st.st_size;
+
+	mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(mapping == MAP_FAILED)
+	{
+		mapping = nullptr;
+		length = 0;
+		return;
+	}
+	// decoders read front to back, so let the kernel read ahead aggressively
+	madvise(mapping, length, MADV_SEQUENTIAL);
+	madvise(mapping, length, MADV_WILLNEED);
+}
+
+MappedFile::~MappedFile()
+{
+	if(mapping)
+		munmap(mapping, length);
+	if(fd >= 0)
+	{
+		if(dropCache)
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+bool MappedFile::isOpen() const
+{
+	return mapping != nullptr;
+}
+
+const unsigned char* MappedFile::data() const
+{
+	return static_cast<const unsigned char*>(mapping);
+}
+
+size_t MappedFile::size() const
+{
+	return length;
+}
+
+void prefetchFile(const std::filesystem::path& path)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
+
+static uint32_t readBigEndian(const unsigned char* data, size_t bytes)
+{
+	uint32_t out = 0;
+	for(size_t i = 0; i < bytes; ++i)
+		out = (out << 8) | data[i];
+	return out;
+}
+
+static bool readJpegSize(const unsigned char* data, size_t size, cv::Size& imageSize)
+{
+	size_t pos = 2;
+	while(pos + 4 <= size)
+	{
+		if(data[pos] != 0xFF)
+			return false;
+		unsigned char marker = data[pos+1];
+		if(marker == 0xFF)
+		{
+			++pos;
+			continue;
+		}
+
+		// markers without a payload
+		if(marker == 0x01 || marker == 0xD8 || (marker >= 0xD0 && marker <= 0xD7))
+		{
+			pos += 2;
+			continue;
+		}
+
+		// start of scan, there are no more frame headers before the entropy coded data
+		if(marker == 0xDA || marker == 0xD9)
+			return false;
+
+		size_t length = readBigEndian(data+pos+2, 2);
+		if(length < 2)
+			return false;
+
+		// all SOFn markers except DHT, JPG and DAC
+		if(marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+		{
+			if(pos + 9 > size)
+				return false;
+			imageSize.height = readBigEndian(data+pos+5, 2);
+			imageSize.width = readBigEndian(data+pos+7, 2);
+			return imageSize.width > 0 && imageSize.height > 0;
+		}
+
+		pos += 2 + length;
+	}
+	return false;
+}
+
+static bool readPngSize(const unsigned char* data, size_t size, cv::Size& imageSize)
+{
+	if(size < 24 || std::memcmp(data+12, "IHDR", 4) != 0)
+		return false;
+	imageSize.width = readBigEndian(data+16, 4);
+	imageSize.height = readBigEndian(data+20, 4);
+	return imageSize.width > 0 && imageSize.height > 0;
+}
+
+bool readImageSize(const unsigned char* data, size_t size, cv::Size& imageSize, bool& isJpeg)
+{
+	static constexpr unsigned char pngSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+	isJpeg = false;
+	if(size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF)
+	{
+		isJpeg = true;
+		return readJpegSize(data, size, imageSize);
+	}
+	else if(size >= sizeof(pngSignature) && std::memcmp(data, pngSignature, sizeof(pngSignature)) == 0)
+	{
+		return readPngSize(data, size, imageSize);
+	}
+	return false;
+}
+
+cv::Mat decodeImageScaled(const unsigned char* data, size_t size, int scale)
+{
+	int flags = cv::IMREAD_COLOR;
+	if(scale == 8)
+		flags = cv::IMREAD_REDUCED_COLOR_8;
+	else if(scale == 4)
+		flags = cv::IMREAD_REDUCED_COLOR_4;
+	else if(scale == 2)
+		flags = cv::IMREAD_REDUCED_COLOR_2;
+
+	cv::Mat buffer(1, static_cast<int>(size), CV_8U, const_cast<unsigned char*>(data));
+	return cv::imdecode(buffer, flags);
+}
+
+int decodeScale(const cv::Size& imageSize, bool isJpeg, int minLongSide)
+{
+	if(minLongSide <= 0 || !isJpeg)
+		return 1;
+
+	int longSide = std::max(imageSize.width, imageSize.height);
+	// libjpeg rounds scaled dimensions up
+	int scale;
+	for(scale = 8; scale > 1; scale /= 2)
+	{
+		if((longSide+scale-1)/scale >= minLongSide)
+			break;
+	}
+	return scale;
+}
+
+cv::Mat decodeImage(const unsigned char* data, size_t size, int minLongSide)
+{
+	int scale = 1;
+
+	cv::Size imageSize;
+	bool isJpeg;
+	if(minLongSide > 0 && readImageSize(data, size, imageSize, isJpeg) && isJpeg)
+	{
+		scale = decodeScale(imageSize, isJpeg, minLongSide);
+		Log(Log::DEBUG)<<"Decodeing jpeg of size "<<imageSize<<" at 1/"<<scale<<" scale";
+	}
+
+	return decodeImageScaled(data, size, scale);
+}
+
+cv::Mat decodeThumbnail(const unsigned char* data, size_t size)
+{
+	cv::Size imageSize;
+	bool isJpeg = false;
+	if(!readImageSize(data, size, imageSize, isJpeg) || !isJpeg)
+		return cv::Mat();
+	cv::Mat buffer(1, static_cast<int>(size), CV_8U, const_cast<unsigned char*>(data));
+	return cv::imdecode(buffer, cv::IMREAD_REDUCED_GRAYSCALE_8);
+}
+
+cv::Mat loadImage(const std::filesystem::path& path, int minLongSide)
+{
+	std::vector<unsigned char> data;
+	if(!readFileData(path, data) || data.empty())
+		return cv::Mat();
+	return decodeImage(data.data(), data.size(), minLongSide);
+}
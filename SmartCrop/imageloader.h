@@ -0,0 +1,69 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <opencv2/core.hpp>
+
+bool readFileData(const std::filesystem::path& path, std::vector<unsigned char>& data);
+
+// A read only mapping of a whole file. With dropCache the files pages are evicted from the
+// page cache when the mapping is released, so streaming over a dataset much larger than memory
+// does not push the model and everything else out of the cache.
+class MappedFile
+{
+private:
+	int fd = -1;
+	void* mapping = nullptr;
+	size_t length = 0;
+	bool dropCache;
+
+public:
+	MappedFile(const std::filesystem::path& path, bool dropCache = false);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	bool isOpen() const;
+	const unsigned char* data() const;
+	size_t size() const;
+};
+
+// asks the kernel to start reading the file in the background
+void prefetchFile(const std::filesystem::path& path);
+
+bool readImageSize(const unsigned char* data, size_t size, cv::Size& imageSize, bool& isJpeg);
+
+// the dct scale decodeImage() uses for an image of this size
+int decodeScale(const cv::Size& imageSize, bool isJpeg, int minLongSide);
+
+// decodes the image, for jpeg images libjpeg's dct scaling is used to decode at 1/2, 1/4 or 1/8
+// of the size if the long side of the image remains at least minLongSide pixels long
+cv::Mat decodeImage(const unsigned char* data, size_t size, int minLongSide = 0);
+
+// decodes the image at 1/scale of its size, scale must be 1, 2, 4 or 8
+// only for jpeg images is this cheaper than decodeing at full size
+cv::Mat decodeImageScaled(const unsigned char* data, size_t size, int scale);
+
+// decodes a small grayscale version of a jpeg image at 1/8 of its size, empty for other formats
+// since for those it would be as expensive as a full decode
+cv::Mat decodeThumbnail(const unsigned char* data, size_t size);
+
+cv::Mat loadImage(const std::filesystem::path& path, int minLongSide = 0);
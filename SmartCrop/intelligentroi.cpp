@@ -21,6 +21,8 @@
 #include "intelligentroi.h"
 
 #include <opencv2/imgproc.hpp>
+#include <cmath>
+#include <limits>
 
 #include "utils.h"
 #include "log.h"
@@ -133,3 +135,55 @@ bool InteligentRoi::getCropRectangle(cv::Rect& out, const std::vector<Yolo::Dete
 	out = maxRect(incompleate, imageSize, targetAspectRatio, corners);
 	return incompleate;
 }
+
+size_t InteligentRoi::getBestBucket(cv::Rect& out, bool& incompleate, const std::vector<Yolo::Detection>& detections, const cv::Size2i& imageSize,
+	const std::vector<cv::Size>& buckets, double sourceScale)
+{
+	// how much content a halving or doubling of the image is worth
+	static constexpr double scalingWeight = 0.1;
+	// how much keeping all of the image is worth over keeping none of it, this decides between buckets
+	// that keep the same detections, most importantly when there are none
+	static constexpr double areaWeight = 0.25;
+
+	double totalPriority = 0;
+	for(const Yolo::Detection& detection : detections)
+	{
+		if(detection.priority > 0 && detection.box.area() > 0)
+			totalPriority += detection.priority;
+	}
+
+	size_t best = 0;
+	double bestScore = -std::numeric_limits<double>::infinity();
+	for(size_t i = 0; i < buckets.size(); ++i)
+	{
+		cv::Rect crop;
+		bool bucketIncompleate = getCropRectangle(crop, detections, imageSize, buckets[i].aspectRatio());
+		if(crop.area() <= 0)
+			continue;
+
+		double kept = 1.0;
+		if(totalPriority > 0)
+		{
+			kept = 0;
+			for(const Yolo::Detection& detection : detections)
+			{
+				if(detection.priority > 0 && detection.box.area() > 0)
+					kept += detection.priority*static_cast<double>((detection.box & crop).area())/detection.box.area();
+			}
+			kept /= totalPriority;
+		}
+
+		double areaKept = static_cast<double>(crop.area())/imageSize.area();
+		double scale = buckets[i].width/(crop.width*sourceScale);
+		double score = kept + areaWeight*areaKept - scalingWeight*std::abs(std::log2(scale));
+		Log(Log::DEBUG)<<"bucket "<<buckets[i]<<" crop "<<crop<<" keeps "<<kept<<" and "<<areaKept<<" of the image at scale "<<scale<<" score "<<score;
+		if(score > bestScore)
+		{
+			bestScore = score;
+			best = i;
+			out = crop;
+			incompleate = bucketIncompleate;
+		}
+	}
+	return best;
+}
@@ -29,9 +29,14 @@ private:
 	int personId;
 	static bool compPointPrio(const std::pair<cv::Point2i, int>& a, const std::pair<cv::Point2i, int>& b, const cv::Point2i& center);
 	static void slideRectToPoint(cv::Rect& rect, const cv::Point2i& point);
-	static cv::Rect maxRect(bool& incompleate, const cv::Size2i& imageSize, double targetAspectRatio, std::vector<std::pair<cv::Point2i, int>> mustInclude = {});
 
 public:
+	// the largest rectangle of targetAspectRatio that includes as many of the priority weighted points as possible
+	static cv::Rect maxRect(bool& incompleate, const cv::Size2i& imageSize, double targetAspectRatio, std::vector<std::pair<cv::Point2i, int>> mustInclude = {});
 	InteligentRoi(const Yolo& yolo);
 	bool getCropRectangle(cv::Rect& out, const std::vector<Yolo::Detection>& detections, const cv::Size2i& imageSize, double targetAspectRatio);
+	// evaluates every bucket against the same detections and returns the index of the bucket whose crop keeps the
+	// most priority weighted content and image area with the least scaling, sourceScale is the ratio of the source image to imageSize
+	size_t getBestBucket(cv::Rect& out, bool& incompleate, const std::vector<Yolo::Detection>& detections, const cv::Size2i& imageSize,
+		const std::vector<cv::Size>& buckets, double sourceScale = 1.0);
 };
@@ -0,0 +1,275 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "jobstream.h"
+
+#include <sstream>
+#include <cmath>
+
+#include "json.h"
+#include "pipeline.h"
+#include "imageloader.h"
+#include "tokenize.h"
+#include "log.h"
+
+static std::string formatNumber(double value)
+{
+	std::ostringstream stream;
+	if(value == std::trunc(value) && std::abs(value) < 1e15)
+		stream<<static_cast<long long>(value);
+	else
+		stream<<value;
+	return stream.str();
+}
+
+static std::string formatRect(const cv::Rect& rect)
+{
+	std::ostringstream stream;
+	stream<<'['<<rect.x<<", "<<rect.y<<", "<<rect.width<<", "<<rect.height<<']';
+	return stream.str();
+}
+
+static bool parseDimension(const JsonValue& value, int& dimension)
+{
+	double number = value.asNumber(-1);
+	if(value.getType() != JsonValue::JSON_NUMBER || number < 1 || number > 65535 || number != std::trunc(number))
+		return false;
+	dimension = number;
+	return true;
+}
+
+JobStream::JobStream(const Config& configIn):
+	config(configIn), fileWriter(std::filesystem::current_path(), 0), cropper(configIn)
+{
+	if(!cropper.isOpen())
+		Log(Log::ERROR)<<cropper.getError();
+}
+
+bool JobStream::isOpen() const
+{
+	return cropper.isOpen();
+}
+
+bool JobStream::parseJob(const JsonValue& record, Job& job, std::string& error) const
+{
+	const JsonValue& id = record["id"];
+	if(id.getType() == JsonValue::JSON_STRING)
+		job.id = '"' + escapeJson(id.asString()) + '"';
+	else if(id.getType() == JsonValue::JSON_NUMBER)
+		job.id = formatNumber(id.asNumber());
+
+	if(record.getType() != JsonValue::JSON_OBJECT)
+	{
+		error = "job record is not an object";
+		return false;
+	}
+	if(record["input"].getType() != JsonValue::JSON_STRING || record["input"].asString().empty())
+	{
+		error = "job has no input";
+		return false;
+	}
+	job.input = record["input"].asString();
+	job.output = record["output"].asString();
+
+	job.options = std::make_shared<ImageOptions>();
+	job.options->seamCarving = record["seamCarving"].asBool(config.seamCarving);
+	if(record.has("format"))
+		job.options->outputFormat = record["format"].asString();
+	else
+		job.options->outputFormat = job.output.extension().string();
+	if(job.options->outputFormat.empty())
+		job.options->outputFormat = config.outputFormat;
+	if(!job.options->outputFormat.empty() && job.options->outputFormat[0] != '.')
+		job.options->outputFormat.insert(0, 1, '.');
+
+	const JsonValue& sizes = record["sizes"];
+	if(!sizes.isNull())
+	{
+		for(size_t i = 0; i < sizes.size(); ++i)
+		{
+			cv::Size size;
+			if(sizes[i].size() != 2 || !parseDimension(sizes[i][0], size.width) || !parseDimension(sizes[i][1], size.height))
+			{
+				error = "sizes must be a list of [width, height] pairs";
+				return false;
+			}
+			job.options->targetSizes.push_back(size);
+		}
+		if(job.options->targetSizes.empty())
+		{
+			error = "sizes is empty";
+			return false;
+		}
+	}
+	else
+	{
+		cv::Size size = config.targetSizes.front();
+		if((record.has("width") && !parseDimension(record["width"], size.width)) ||
+			(record.has("height") && !parseDimension(record["height"], size.height)))
+		{
+			error = "width and height must be positive integers";
+			return false;
+		}
+		job.options->targetSizes.push_back(size);
+	}
+	return true;
+}
+
+std::filesystem::path JobStream::outputPath(const Job& job, const cv::Size& size) const
+{
+	if(job.options->targetSizes.size() < 2)
+		return job.output;
+	std::filesystem::path path = job.output;
+	path.replace_filename(job.output.stem().string() + '-' + Pipeline::sizeDirName(size) + job.output.extension().string());
+	return path;
+}
+
+void JobStream::writeRecord(const std::string& record, bool ok)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	*out<<record<<'\n';
+	out->flush();
+	if(ok)
+		++completed;
+	else
+		++failed;
+}
+
+void JobStream::writeFailure(const Job& job, const std::string& error)
+{
+	Log(Log::WARN)<<(job.input.empty() ? std::string("job") : job.input.string())<<": "<<error;
+	std::ostringstream record;
+	record<<'{';
+	if(!job.id.empty())
+		record<<"\"id\": "<<job.id<<", ";
+	record<<"\"input\": \""<<escapeJson(job.input.string())<<"\", \"ok\": false, \"error\": \""<<escapeJson(error)<<"\"}";
+	writeRecord(record.str(), false);
+}
+
+void JobStream::finishJob(const Job& job, Cropper::Result& result)
+{
+	if(!result.ok)
+	{
+		writeFailure(job, "could not process image");
+		return;
+	}
+
+	std::vector<std::filesystem::path> paths;
+	if(!job.output.empty())
+	{
+		std::error_code ec;
+		if(job.output.has_parent_path())
+			std::filesystem::create_directories(job.output.parent_path(), ec);
+		for(const Cropper::Output& output : result.outputs)
+		{
+			paths.push_back(outputPath(job, output.size));
+			if(!fileWriter.write(paths.back(), output.encoded))
+			{
+				writeFailure(job, "could not write " + paths.back().string());
+				return;
+			}
+		}
+	}
+
+	std::ostringstream record;
+	record<<'{';
+	if(!job.id.empty())
+		record<<"\"id\": "<<job.id<<", ";
+	record<<"\"input\": \""<<escapeJson(job.input.string())<<"\", \"ok\": true, \"sourceWidth\": "<<result.sourceSize.width
+		<<", \"sourceHeight\": "<<result.sourceSize.height<<", \"detections\": [";
+	for(size_t i = 0; i < result.detections.size(); ++i)
+	{
+		const Yolo::Detection& detection = result.detections[i];
+		record<<(i > 0 ? ", " : "")<<"{\"class\": \""<<escapeJson(detection.className)<<"\", \"confidence\": "<<detection.confidence
+			<<", \"priority\": "<<detection.priority<<", \"box\": "<<formatRect(detection.box)<<'}';
+	}
+	record<<"], \"outputs\": [";
+	for(size_t i = 0; i < result.outputs.size(); ++i)
+	{
+		const Cropper::Output& output = result.outputs[i];
+		record<<(i > 0 ? ", " : "")<<'{';
+		if(!paths.empty())
+			record<<"\"path\": \""<<escapeJson(paths[i].string())<<"\", ";
+		record<<"\"width\": "<<output.size.width<<", \"height\": "<<output.size.height<<", \"crop\": "<<formatRect(output.crop)
+			<<", \"seamCarved\": "<<(output.seamCarved ? "true" : "false")<<", \"incompleate\": "<<(output.incompleate ? "true" : "false")<<'}';
+	}
+	record<<"], \"timings\": {";
+	for(size_t stage = 0; stage < Pipeline::STAGE_COUNT; ++stage)
+	{
+		record<<(stage > 0 ? ", " : "")<<'"'<<Pipeline::stageName(static_cast<Pipeline::Stage>(stage))<<"\": "
+			<<result.stageTimes[stage].count();
+	}
+	record<<"}}";
+	writeRecord(record.str(), true);
+}
+
+void JobStream::run(std::istream& in, std::ostream& outStream)
+{
+	out = &outStream;
+	std::string line;
+	while(std::getline(in, line))
+	{
+		if(line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+
+		std::shared_ptr<Job> job = std::make_shared<Job>();
+		JsonValue record;
+		std::string error;
+		if(!JsonValue::parse(line, record, error))
+		{
+			writeFailure(*job, "invalid job record: " + error);
+			continue;
+		}
+		if(!parseJob(record, *job, error))
+		{
+			writeFailure(*job, error);
+			continue;
+		}
+
+		// submit blocks while the pipeline is behind, so only a few images are read ahead
+		std::vector<unsigned char> data;
+		if(!readFileData(job->input, data))
+		{
+			writeFailure(*job, "could not read " + job->input.string());
+			continue;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++pending;
+		}
+		cropper.submit(std::move(data), [this, job](Cropper::Result& result)
+		{
+			finishJob(*job, result);
+			std::lock_guard<std::mutex> lock(mutex);
+			--pending;
+			pendingCondition.notify_all();
+		}, job->options);
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	pendingCondition.wait(lock, [this](){return pending == 0;});
+}
+
+void JobStream::logStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Log(Log::INFO)<<"Completed "<<completed<<" jobs, "<<failed<<" failed";
+}
@@ -0,0 +1,88 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <istream>
+#include <ostream>
+
+#include "config.h"
+#include "cropper.h"
+#include "filewriter.h"
+
+class JsonValue;
+
+// Reads newline delimited JSON job records and writes one JSON result record per image, so that
+// other programs can feed images to a single long running process as they go.
+//
+// Job records, everything but input is optional:
+//   {"id": 7, "input": "in.jpg", "output": "out.png", "width": 1024, "height": 1024,
+//    "sizes": [[1024, 1024], [768, 1024]], "seamCarving": true, "format": ".png"}
+// sizes takes precedence over width and height, which default to the first -x/-y size. With multiple
+// sizes WIDTHxHEIGHT is appended to the stem of the output path. Without an output the image is only
+// analyzed. The format defaults to the extension of the output.
+//
+// Result records, in the order the images complete, id is only present if the job had one:
+//   {"id": 7, "input": "in.jpg", "ok": true, "sourceWidth": 4000, "sourceHeight": 3000,
+//    "detections": [{"class": "person", "confidence": 0.91, "priority": 10, "box": [x, y, w, h]}],
+//    "outputs": [{"path": "out.png", "width": 1024, "height": 1024, "crop": [x, y, w, h], "seamCarved": false, "incompleate": false}],
+//    "timings": {"decode": 0.012, "detect": 0.31, "crop": 0.004, "encode": 0.006}}
+//   {"id": 7, "input": "in.jpg", "ok": false, "error": "could not read in.jpg"}
+// Rectangles are in the coordinates of the source image, timings are the seconds spent in each stage.
+class JobStream
+{
+private:
+	struct Job
+	{
+		// the id of the job record as JSON, empty if it had none
+		std::string id;
+		std::filesystem::path input;
+		std::filesystem::path output;
+		std::shared_ptr<ImageOptions> options;
+	};
+
+	const Config& config;
+	FileWriter fileWriter;
+	std::ostream* out = nullptr;
+	std::mutex mutex;
+	std::condition_variable pendingCondition;
+	size_t pending = 0;
+	size_t completed = 0;
+	size_t failed = 0;
+	// last so that the pipeline is finished before anything its callbacks use is destroyed
+	Cropper cropper;
+
+	bool parseJob(const JsonValue& record, Job& job, std::string& error) const;
+	std::filesystem::path outputPath(const Job& job, const cv::Size& size) const;
+	void finishJob(const Job& job, Cropper::Result& result);
+	void writeFailure(const Job& job, const std::string& error);
+	void writeRecord(const std::string& record, bool ok);
+
+public:
+	explicit JobStream(const Config& config);
+	bool isOpen() const;
+	// processes the jobs read from in until it ends and returns once every result has been written to out
+	void run(std::istream& in, std::ostream& out);
+	void logStats();
+};
@@ -0,0 +1,207 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "journal.h"
+
+#include <sstream>
+#include <vector>
+
+#include "tokenize.h"
+#include "hash.h"
+#include "log.h"
+
+Journal::Journal(const std::filesystem::path& path)
+{
+	std::ifstream in(path);
+	if(in.is_open())
+	{
+		std::string line;
+		size_t lineNumber = 0;
+		while(std::getline(in, line))
+		{
+			++lineNumber;
+			if(line.empty())
+				continue;
+			Entry entry;
+			if(!parseLine(line, entry))
+			{
+				Log(Log::WARN)<<"ignoring malformed line "<<lineNumber<<" in journal "<<path;
+				continue;
+			}
+			entries[makeKey(entry.input)] = entry;
+		}
+		Log(Log::INFO)<<"Loaded "<<entries.size()<<" entries from journal "<<path;
+	}
+
+	file.open(path, std::ios::out | std::ios::app);
+	if(!file.is_open())
+		Log(Log::ERROR)<<"could not open journal "<<path<<" for writing";
+}
+
+bool Journal::isOpen() const
+{
+	return file.is_open();
+}
+
+size_t Journal::size() const
+{
+	return entries.size();
+}
+
+std::string Journal::makeKey(const std::filesystem::path& path)
+{
+	std::error_code ec;
+	std::filesystem::path absolute = std::filesystem::absolute(path, ec);
+	if(ec)
+		return path.lexically_normal().string();
+	return absolute.lexically_normal().string();
+}
+
+bool Journal::parseLine(const std::string& line, Entry& entry)
+{
+	std::vector<std::string> tokens = tokenizeBinaryIgnore(line, '\t');
+	if(tokens.size() != 7)
+		return false;
+
+	try
+	{
+		if(tokens[0] == "ok")
+			entry.status = STATUS_OK;
+		else if(tokens[0] == "failed")
+			entry.status = STATUS_FAILED;
+		else
+			return false;
+		entry.size = std::stoull(tokens[1]);
+		entry.mtime = std::stoll(tokens[2]);
+		entry.contentHash = std::stoull(tokens[3], nullptr, 16);
+		entry.configFingerprint = std::stoull(tokens[4], nullptr, 16);
+	}
+	catch(const std::logic_error& err)
+	{
+		return false;
+	}
+	entry.input = unescapeSeperators(tokens[5]);
+	entry.output = unescapeSeperators(tokens[6]);
+	return true;
+}
+
+bool Journal::outputExists(const std::filesystem::path& output)
+{
+	// images encoded in memory have no output on disk
+	if(output.empty())
+		return true;
+
+	std::error_code ec;
+	if(std::filesystem::exists(output, ec))
+		return true;
+
+	// members of tar shards are recorded as archive/member
+	if(output.has_parent_path() && std::filesystem::is_regular_file(output.parent_path(), ec))
+		return true;
+
+	// records of packed files are recorded as file:record
+	const std::string& str = output.native();
+	size_t colon = str.rfind(':');
+	if(colon != std::string::npos && colon+1 < str.size() &&
+		str.find_first_not_of("0123456789", colon+1) == std::string::npos)
+		return std::filesystem::is_regular_file(str.substr(0, colon), ec);
+
+	return false;
+}
+
+bool Journal::isDone(const Entry& candidate, bool checkConfig) const
+{
+	auto search = entries.find(makeKey(candidate.input));
+	if(search == entries.end())
+		return false;
+
+	const Entry& entry = search->second;
+	if(entry.status != STATUS_OK || entry.size != candidate.size)
+		return false;
+
+	// with content hashes the mtime is irrelevant, files touched by copying are still recognized
+	if(candidate.contentHash != 0 || entry.contentHash != 0)
+	{
+		if(entry.contentHash != candidate.contentHash)
+			return false;
+	}
+	else if(entry.mtime != candidate.mtime)
+	{
+		return false;
+	}
+
+	if(checkConfig && entry.configFingerprint != candidate.configFingerprint)
+		return false;
+
+	if(!outputExists(entry.output))
+	{
+		Log(Log::DEBUG)<<"output "<<entry.output<<" of "<<entry.input<<" is missing, processing it again";
+		return false;
+	}
+
+	return true;
+}
+
+void Journal::append(const Entry& entry)
+{
+	std::stringstream ss;
+	ss<<(entry.status == STATUS_OK ? "ok" : "failed")<<'\t'<<entry.size<<'\t'<<entry.mtime<<'\t'
+		<<hashToString(entry.contentHash)<<'\t'<<hashToString(entry.configFingerprint)<<'\t'
+		<<escapeSeperators(makeKey(entry.input))<<'\t'<<escapeSeperators(entry.output.string())<<'\n';
+
+	std::lock_guard<std::mutex> lock(mutex);
+	file<<ss.str();
+	file.flush();
+}
+
+bool Journal::statInput(const std::filesystem::path& path, Entry& entry)
+{
+	std::error_code ec;
+	entry.input = path;
+	entry.size = std::filesystem::file_size(path, ec);
+	if(ec)
+		return false;
+	std::filesystem::file_time_type mtime = std::filesystem::last_write_time(path, ec);
+	if(ec)
+		return false;
+	entry.mtime = mtime.time_since_epoch().count();
+	return true;
+}
+
+uint64_t Journal::configFingerprint(const Config& config)
+{
+	// only the fields that change the output images belong here
+	std::stringstream ss;
+	ss<<config.modelPath.string()<<'\n'
+		<<config.classesPath.string()<<'\n'
+		<<config.focusPersonImage.string()<<'\n'
+		<<config.threshold<<'\n'
+		<<config.seamCarving<<'\n';
+	for(const cv::Size& size : config.targetSizes)
+		ss<<size.width<<'x'<<size.height<<'\n';
+	ss<<"buckets\n";
+	for(const cv::Size& size : config.buckets)
+		ss<<size.width<<'x'<<size.height<<'\n';
+	ss<<config.proxySize<<'\n'
+		<<config.outputFormat<<'\n'
+		<<config.jpegQuality<<' '<<config.pngCompression<<' '<<config.webpQuality<<'\n'
+		<<config.outputTarSize<<' '<<config.packedOutput<<'\n';
+	return hashString(ss.str());
+}
@@ -0,0 +1,73 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+#include "config.h"
+
+// Append only record of processed images, used to skip already finished images
+// when a run is restarted. Later lines override earlier lines for the same input.
+class Journal
+{
+public:
+	enum Status
+	{
+		STATUS_OK,
+		STATUS_FAILED
+	};
+
+	struct Entry
+	{
+		std::filesystem::path input;
+		uintmax_t size = 0;
+		int64_t mtime = 0;
+		uint64_t contentHash = 0;
+		uint64_t configFingerprint = 0;
+		std::filesystem::path output;
+		Status status = STATUS_OK;
+	};
+
+private:
+	std::unordered_map<std::string, Entry> entries;
+	std::ofstream file;
+	std::mutex mutex;
+
+	static std::string makeKey(const std::filesystem::path& path);
+	bool parseLine(const std::string& line, Entry& entry);
+	static bool outputExists(const std::filesystem::path& output);
+
+public:
+	Journal(const std::filesystem::path& path);
+	bool isOpen() const;
+	size_t size() const;
+	// entries are only loaded at construction, so this is safe to call from many threads while appending,
+	// an image whose recorded output was deleted since is not done
+	bool isDone(const Entry& candidate, bool checkConfig) const;
+	void append(const Entry& entry);
+
+	static bool statInput(const std::filesystem::path& path, Entry& entry);
+	static uint64_t configFingerprint(const Config& config);
+};
@@ -0,0 +1,384 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "json.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+
+class JsonParser
+{
+private:
+	const std::string& text;
+	size_t pos = 0;
+	std::string error;
+
+	static constexpr int maxDepth = 64;
+
+	bool fail(const std::string& message)
+	{
+		if(error.empty())
+			error = message + " at offset " + std::to_string(pos);
+		return false;
+	}
+
+	void skipWhitespace()
+	{
+		while(pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+			++pos;
+	}
+
+	bool expectWord(const char* word)
+	{
+		size_t length = std::strlen(word);
+		if(text.compare(pos, length, word) != 0)
+			return fail("invalid literal");
+		pos += length;
+		return true;
+	}
+
+	static void appendUtf8(std::string& out, unsigned codepoint)
+	{
+		if(codepoint < 0x80)
+		{
+			out.push_back(codepoint);
+		}
+		else if(codepoint < 0x800)
+		{
+			out.push_back(0xc0 | (codepoint >> 6));
+			out.push_back(0x80 | (codepoint & 0x3f));
+		}
+		else if(codepoint < 0x10000)
+		{
+			out.push_back(0xe0 | (codepoint >> 12));
+			out.push_back(0x80 | ((codepoint >> 6) & 0x3f));
+			out.push_back(0x80 | (codepoint & 0x3f));
+		}
+		else
+		{
+			out.push_back(0xf0 | (codepoint >> 18));
+			out.push_back(0x80 | ((codepoint >> 12) & 0x3f));
+			out.push_back(0x80 | ((codepoint >> 6) & 0x3f));
+			out.push_back(0x80 | (codepoint & 0x3f));
+		}
+	}
+
+	bool parseHex(unsigned& value)
+	{
+		if(pos + 4 > text.size())
+			return fail("truncated escape");
+		value = 0;
+		for(size_t i = 0; i < 4; ++i)
+		{
+			char ch = text[pos++];
+			value <<= 4;
+			if(ch >= '0' && ch <= '9')
+				value |= ch - '0';
+			else if(ch >= 'a' && ch <= 'f')
+				value |= ch - 'a' + 10;
+			else if(ch >= 'A' && ch <= 'F')
+				value |= ch - 'A' + 10;
+			else
+				return fail("invalid escape");
+		}
+		return true;
+	}
+
+	bool parseString(std::string& out)
+	{
+		// the opening quote has already been checked
+		++pos;
+		while(pos < text.size())
+		{
+			char ch = text[pos++];
+			if(ch == '"')
+				return true;
+			if(static_cast<unsigned char>(ch) < 0x20)
+				return fail("control character in string");
+			if(ch != '\\')
+			{
+				out.push_back(ch);
+				continue;
+			}
+			if(pos >= text.size())
+				break;
+			ch = text[pos++];
+			switch(ch)
+			{
+				case '"':
+				case '\\':
+				case '/':
+					out.push_back(ch);
+					break;
+				case 'b':
+					out.push_back('\b');
+					break;
+				case 'f':
+					out.push_back('\f');
+					break;
+				case 'n':
+					out.push_back('\n');
+					break;
+				case 'r':
+					out.push_back('\r');
+					break;
+				case 't':
+					out.push_back('\t');
+					break;
+				case 'u':
+				{
+					unsigned codepoint;
+					if(!parseHex(codepoint))
+						return false;
+					if(codepoint >= 0xd800 && codepoint < 0xdc00)
+					{
+						unsigned low;
+						if(text.compare(pos, 2, "\\u") != 0)
+							return fail("unpaired surrogate");
+						pos += 2;
+						if(!parseHex(low))
+							return false;
+						if(low < 0xdc00 || low >= 0xe000)
+							return fail("unpaired surrogate");
+						codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+					}
+					else if(codepoint >= 0xdc00 && codepoint < 0xe000)
+					{
+						return fail("unpaired surrogate");
+					}
+					appendUtf8(out, codepoint);
+					break;
+				}
+				default:
+					return fail("invalid escape");
+			}
+		}
+		return fail("unterminated string");
+	}
+
+	bool parseNumber(double& out)
+	{
+		size_t start = pos;
+		if(pos < text.size() && text[pos] == '-')
+			++pos;
+		if(pos >= text.size() || !std::isdigit(static_cast<unsigned char>(text[pos])))
+			return fail("invalid number");
+		while(pos < text.size() && std::strchr("0123456789+-.eE", text[pos]))
+			++pos;
+		std::string number = text.substr(start, pos-start);
+		char* end;
+		out = std::strtod(number.c_str(), &end);
+		if(*end != '\0')
+		{
+			pos = start;
+			return fail("invalid number");
+		}
+		return true;
+	}
+
+	bool parseValue(JsonValue& value, int depth)
+	{
+		if(depth > maxDepth)
+			return fail("nested too deeply");
+		skipWhitespace();
+		if(pos >= text.size())
+			return fail("unexpected end");
+
+		char ch = text[pos];
+		if(ch == '{')
+		{
+			value.type = JsonValue::JSON_OBJECT;
+			++pos;
+			skipWhitespace();
+			if(pos < text.size() && text[pos] == '}')
+			{
+				++pos;
+				return true;
+			}
+			while(true)
+			{
+				skipWhitespace();
+				if(pos >= text.size() || text[pos] != '"')
+					return fail("expected key");
+				std::string key;
+				if(!parseString(key))
+					return false;
+				skipWhitespace();
+				if(pos >= text.size() || text[pos] != ':')
+					return fail("expected ':'");
+				++pos;
+				JsonValue member;
+				if(!parseValue(member, depth+1))
+					return false;
+				value.keys.push_back(std::move(key));
+				value.values.push_back(std::move(member));
+				skipWhitespace();
+				if(pos < text.size() && text[pos] == ',')
+				{
+					++pos;
+					continue;
+				}
+				if(pos < text.size() && text[pos] == '}')
+				{
+					++pos;
+					return true;
+				}
+				return fail("expected ',' or '}'");
+			}
+		}
+		else if(ch == '[')
+		{
+			value.type = JsonValue::JSON_ARRAY;
+			++pos;
+			skipWhitespace();
+			if(pos < text.size() && text[pos] == ']')
+			{
+				++pos;
+				return true;
+			}
+			while(true)
+			{
+				JsonValue element;
+				if(!parseValue(element, depth+1))
+					return false;
+				value.values.push_back(std::move(element));
+				skipWhitespace();
+				if(pos < text.size() && text[pos] == ',')
+				{
+					++pos;
+					continue;
+				}
+				if(pos < text.size() && text[pos] == ']')
+				{
+					++pos;
+					return true;
+				}
+				return fail("expected ',' or ']'");
+			}
+		}
+		else if(ch == '"')
+		{
+			value.type = JsonValue::JSON_STRING;
+			return parseString(value.string);
+		}
+		else if(ch == 't' || ch == 'f')
+		{
+			value.type = JsonValue::JSON_BOOL;
+			value.boolean = ch == 't';
+			return expectWord(value.boolean ? "true" : "false");
+		}
+		else if(ch == 'n')
+		{
+			value.type = JsonValue::JSON_NULL;
+			return expectWord("null");
+		}
+		value.type = JsonValue::JSON_NUMBER;
+		return parseNumber(value.number);
+	}
+
+public:
+	explicit JsonParser(const std::string& textIn): text(textIn)
+	{
+	}
+
+	bool parse(JsonValue& value)
+	{
+		if(!parseValue(value, 0))
+			return false;
+		skipWhitespace();
+		if(pos != text.size())
+			return fail("trailing characters");
+		return true;
+	}
+
+	const std::string& getError() const
+	{
+		return error;
+	}
+};
+
+static const JsonValue nullValue;
+
+bool JsonValue::parse(const std::string& text, JsonValue& value, std::string& error)
+{
+	value = JsonValue();
+	JsonParser parser(text);
+	if(parser.parse(value))
+		return true;
+	error = parser.getError();
+	value = JsonValue();
+	return false;
+}
+
+JsonValue::Type JsonValue::getType() const
+{
+	return type;
+}
+
+bool JsonValue::isNull() const
+{
+	return type == JSON_NULL;
+}
+
+bool JsonValue::has(const std::string& key) const
+{
+	return !(*this)[key].isNull();
+}
+
+const JsonValue& JsonValue::operator[](const std::string& key) const
+{
+	if(type != JSON_OBJECT)
+		return nullValue;
+	// duplicate keys resolve to the last one like in most parsers
+	for(size_t i = keys.size(); i > 0; --i)
+	{
+		if(keys[i-1] == key)
+			return values[i-1];
+	}
+	return nullValue;
+}
+
+const JsonValue& JsonValue::operator[](size_t index) const
+{
+	if(type != JSON_ARRAY || index >= values.size())
+		return nullValue;
+	return values[index];
+}
+
+size_t JsonValue::size() const
+{
+	return type == JSON_ARRAY || type == JSON_OBJECT ? values.size() : 0;
+}
+
+bool JsonValue::asBool(bool fallback) const
+{
+	return type == JSON_BOOL ? boolean : fallback;
+}
+
+double JsonValue::asNumber(double fallback) const
+{
+	return type == JSON_NUMBER ? number : fallback;
+}
+
+const std::string& JsonValue::asString() const
+{
+	return string;
+}
@@ -0,0 +1,64 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Minimal JSON document model for the job records read in stream mode.
+// Numbers are held as double, accessing a missing key or index yields null.
+class JsonValue
+{
+public:
+	enum Type
+	{
+		JSON_NULL,
+		JSON_BOOL,
+		JSON_NUMBER,
+		JSON_STRING,
+		JSON_ARRAY,
+		JSON_OBJECT
+	};
+
+private:
+	Type type = JSON_NULL;
+	bool boolean = false;
+	double number = 0;
+	std::string string;
+	// array elements, or the values of an object in the order of keys
+	std::vector<JsonValue> values;
+	std::vector<std::string> keys;
+
+	friend class JsonParser;
+
+public:
+	// parses text that holds exactly one value, on failure error describes the problem
+	static bool parse(const std::string& text, JsonValue& value, std::string& error);
+	Type getType() const;
+	bool isNull() const;
+	bool has(const std::string& key) const;
+	const JsonValue& operator[](const std::string& key) const;
+	const JsonValue& operator[](size_t index) const;
+	// number of elements of an array or members of an object
+	size_t size() const;
+	bool asBool(bool fallback = false) const;
+	double asNumber(double fallback = 0) const;
+	const std::string& asString() const;
+};
@@ -32,7 +32,7 @@ Log::~Log()
 {
 	if(opened && endline)
 	{
-		std::cout<<'\n';
+		stream()<<'\n';
 	}
 	opened = false;
 }
@@ -61,3 +61,4 @@ std::string Log::getLabel(Level level)
 
 bool Log::headers = false;
 Log::Level Log::level = WARN;
+bool Log::toStderr = false;
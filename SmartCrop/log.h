@@ -39,11 +39,17 @@ private:
 	bool endline = true;
 
 	std::string getLabel(Level level);
+	std::ostream& stream() const
+	{
+		return msglevel == ERROR || toStderr ? std::cerr : std::cout;
+	}
 
 public:
 
 	static bool headers;
 	static Level level;
+	// write every message to stderr, for modes where stdout carries data
+	static bool toStderr;
 
 	Log() {}
 	Log(Level type, bool endlineI = true);
@@ -53,10 +59,7 @@ public:
 	{
 		if(msglevel >= level)
 		{
-			if(msglevel == ERROR)
-				std::cerr<<msg;
-			else
-				std::cout<<msg;
+			stream()<<msg;
 			opened = true;
 		}
 		return *this;
@@ -0,0 +1,254 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "matpool.h"
+
+#include <sys/mman.h>
+
+#include "log.h"
+
+static thread_local int threadLabel = 0;
+
+struct PoolAllocator::ThreadCache
+{
+	const PoolAllocator* allocator;
+	std::vector<void*> blocks[classCount];
+	size_t bytes = 0;
+
+	~ThreadCache()
+	{
+		for(size_t i = 0; i < classCount; ++i)
+		{
+			size_t classSize = (size_t(1) << (i/4)) + (i%4)*((size_t(1) << (i/4))/4);
+			for(void* block : blocks[i])
+				allocator->freeBlock(block, classSize);
+		}
+	}
+};
+
+PoolAllocator::PoolAllocator(bool hugePagesIn, size_t maxPoolBytesIn): hugePages(hugePagesIn), maxPoolBytes(maxPoolBytesIn), maxThreadBytes(maxPoolBytesIn/8)
+{
+}
+
+void* PoolAllocator::takeShared(size_t index, size_t classSize) const
+{
+	std::lock_guard<std::mutex> lock(sharedMutex);
+	if(shared[index].empty())
+		return nullptr;
+	void* block = shared[index].back();
+	shared[index].pop_back();
+	sharedBytes -= classSize;
+	return block;
+}
+
+bool PoolAllocator::putShared(void* block, size_t index, size_t classSize) const
+{
+	std::lock_guard<std::mutex> lock(sharedMutex);
+	if(sharedBytes + classSize > maxPoolBytes)
+		return false;
+	shared[index].push_back(block);
+	sharedBytes += classSize;
+	return true;
+}
+
+size_t PoolAllocator::sizeClass(size_t size, size_t& classSize)
+{
+	int octave = 63 - __builtin_clzll(size);
+	size_t base = size_t(1) << octave;
+	size_t step = base/4;
+	size_t k = (size - base + step - 1)/step;
+	classSize = base + k*step;
+	return octave*4 + k;
+}
+
+PoolAllocator::ThreadCache& PoolAllocator::threadCache(const PoolAllocator* allocator)
+{
+	static thread_local ThreadCache cache;
+	cache.allocator = allocator;
+	return cache;
+}
+
+void* PoolAllocator::allocateBlock(size_t classSize) const
+{
+	if(hugePages && classSize >= hugePageSize)
+	{
+		size_t length = (classSize + hugePageSize - 1)/hugePageSize*hugePageSize;
+		void* block = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(block == MAP_FAILED)
+			return nullptr;
+		madvise(block, length, MADV_HUGEPAGE);
+		return block;
+	}
+	return cv::fastMalloc(classSize);
+}
+
+void PoolAllocator::freeBlock(void* block, size_t classSize) const
+{
+	if(hugePages && classSize >= hugePageSize)
+		munmap(block, (classSize + hugePageSize - 1)/hugePageSize*hugePageSize);
+	else
+		cv::fastFree(block);
+}
+
+void PoolAllocator::account(int label, int64_t bytes) const
+{
+	LabelStats& stat = stats[label];
+	int64_t live = stat.live += bytes;
+	int64_t peak = stat.peak;
+	while(live > peak && !stat.peak.compare_exchange_weak(peak, live));
+}
+
+cv::UMatData* PoolAllocator::allocate(int dims, const int* sizes, int type, void* data0, size_t* step, cv::AccessFlag, cv::UMatUsageFlags) const
+{
+	size_t total = CV_ELEM_SIZE(type);
+	for(int i = dims-1; i >= 0; i--)
+	{
+		if(step)
+		{
+			if(data0 && step[i] != CV_AUTOSTEP)
+			{
+				CV_Assert(total <= step[i]);
+				total = step[i];
+			}
+			else
+			{
+				step[i] = total;
+			}
+		}
+		total *= sizes[i];
+	}
+
+	cv::UMatData* u = new cv::UMatData(this);
+	u->size = total;
+	if(data0)
+	{
+		u->data = u->origdata = static_cast<uchar*>(data0);
+		u->flags |= cv::UMatData::USER_ALLOCATED;
+		return u;
+	}
+
+	int label = threadLabel;
+	u->allocatorFlags_ = label;
+	LabelStats& stat = stats[label];
+	if(total < minPooledSize)
+	{
+		u->data = u->origdata = static_cast<uchar*>(cv::fastMalloc(total));
+		++stat.unpooled;
+		return u;
+	}
+
+	size_t classSize;
+	size_t index = sizeClass(total, classSize);
+	ThreadCache& cache = threadCache(this);
+	void* block;
+	if(!cache.blocks[index].empty())
+	{
+		block = cache.blocks[index].back();
+		cache.blocks[index].pop_back();
+		cache.bytes -= classSize;
+		++stat.hits;
+	}
+	else if((block = takeShared(index, classSize)))
+	{
+		++stat.hits;
+	}
+	else
+	{
+		block = allocateBlock(classSize);
+		if(!block)
+		{
+			delete u;
+			CV_Error(cv::Error::StsNoMem, "PoolAllocator could not allocate a buffer");
+		}
+		++stat.misses;
+	}
+	account(label, classSize);
+	u->data = u->origdata = static_cast<uchar*>(block);
+	return u;
+}
+
+bool PoolAllocator::allocate(cv::UMatData* u, cv::AccessFlag, cv::UMatUsageFlags) const
+{
+	return u != nullptr;
+}
+
+void PoolAllocator::deallocate(cv::UMatData* u) const
+{
+	if(!u)
+		return;
+	CV_Assert(u->urefcount == 0);
+	CV_Assert(u->refcount == 0);
+
+	if(!(u->flags & cv::UMatData::USER_ALLOCATED))
+	{
+		if(u->size < minPooledSize)
+		{
+			cv::fastFree(u->origdata);
+		}
+		else
+		{
+			// the buffer goes to the cache of the thread freeing it, which is usually the next stage,
+			// and from there to the shared pool for the stage that allocates
+			size_t classSize;
+			size_t index = sizeClass(u->size, classSize);
+			account(u->allocatorFlags_, -static_cast<int64_t>(classSize));
+			ThreadCache& cache = threadCache(this);
+			if(cache.bytes + classSize <= maxThreadBytes)
+			{
+				cache.blocks[index].push_back(u->origdata);
+				cache.bytes += classSize;
+			}
+			else if(!putShared(u->origdata, index, classSize))
+			{
+				freeBlock(u->origdata, classSize);
+			}
+		}
+		u->origdata = nullptr;
+	}
+	delete u;
+}
+
+void PoolAllocator::setThreadLabel(int label)
+{
+	if(label >= 0 && label < maxLabels)
+		threadLabel = label;
+}
+
+void PoolAllocator::logStats(const std::vector<std::string>& labelNames) const
+{
+	for(int i = 0; i < maxLabels; ++i)
+	{
+		const LabelStats& stat = stats[i];
+		size_t pooled = stat.hits + stat.misses;
+		if(pooled == 0 && stat.unpooled == 0)
+			continue;
+		std::string name = i < static_cast<int>(labelNames.size()) ? labelNames[i] : std::to_string(i);
+		double hitRate = pooled > 0 ? static_cast<double>(stat.hits)/pooled*100 : 0;
+		Log(Log::INFO)<<"Allocator "<<name<<": "<<pooled<<" pooled allocations with "<<hitRate<<"% hits, "
+			<<stat.unpooled<<" small allocations, peak "<<stat.peak/(1024*1024)<<"MiB";
+	}
+}
+
+PoolAllocator* PoolAllocator::install(bool hugePages, size_t maxPoolBytes)
+{
+	PoolAllocator* allocator = new PoolAllocator(hugePages, maxPoolBytes);
+	cv::Mat::setDefaultAllocator(allocator);
+	return allocator;
+}
@@ -0,0 +1,86 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// A cv::MatAllocator that keeps freed buffers of similar size in per thread caches so that the
+// large per image buffers are reused instead of going back to the system allocator and being
+// page faulted in again. Since images are usually allocated by one stage and freed by the next,
+// buffers that do not fit into the freeing threads cache go to a shared pool that all threads
+// refill from. Buffers are rounded up to size classes four per power of two, buffers smaller
+// than minPooledSize are not pooled. With huge pages, buffers of 2MiB and up are mmaped
+// and advised to use transparent huge pages.
+//
+// Threads can set a label, usually the pipeline stage they run, that allocations are accounted
+// under for the hit rate and peak byte statistics.
+class PoolAllocator: public cv::MatAllocator
+{
+public:
+	static constexpr size_t minPooledSize = 64*1024;
+	static constexpr size_t hugePageSize = 2*1024*1024;
+	static constexpr int maxLabels = 8;
+	static constexpr size_t classCount = 64*4+1;
+
+private:
+	struct LabelStats
+	{
+		std::atomic<size_t> hits = 0;
+		std::atomic<size_t> misses = 0;
+		std::atomic<size_t> unpooled = 0;
+		std::atomic<int64_t> live = 0;
+		std::atomic<int64_t> peak = 0;
+	};
+
+	struct ThreadCache;
+
+	bool hugePages;
+	size_t maxPoolBytes;
+	size_t maxThreadBytes;
+	mutable LabelStats stats[maxLabels];
+	mutable std::mutex sharedMutex;
+	mutable std::vector<void*> shared[classCount];
+	mutable size_t sharedBytes = 0;
+
+	static size_t sizeClass(size_t size, size_t& classSize);
+	static ThreadCache& threadCache(const PoolAllocator* allocator);
+	void* allocateBlock(size_t classSize) const;
+	void freeBlock(void* block, size_t classSize) const;
+	void account(int label, int64_t bytes) const;
+	void* takeShared(size_t index, size_t classSize) const;
+	bool putShared(void* block, size_t index, size_t classSize) const;
+
+public:
+	// maxPoolBytes limits the bytes of free buffers in the shared pool, each thread caches up to an eighth of that
+	PoolAllocator(bool hugePages, size_t maxPoolBytes);
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+	bool allocate(cv::UMatData* data, cv::AccessFlag accessflags, cv::UMatUsageFlags usageFlags) const override;
+	void deallocate(cv::UMatData* data) const override;
+	void logStats(const std::vector<std::string>& labelNames) const;
+
+	static void setThreadLabel(int label);
+	// creates the allocator and makes it the default for all cv::Mats, the allocator is never destroyed
+	// as Mats may outlive main
+	static PoolAllocator* install(bool hugePages, size_t maxPoolBytes);
+};
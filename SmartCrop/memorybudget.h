@@ -0,0 +1,88 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <algorithm>
+
+// Limits the estimated number of bytes held by images in flight. acquire() blocks until the
+// request fits. A request larger than the whole budget is clamped to it, so such an image
+// waits until nothing else is in flight and is then processed alone instead of failing.
+class MemoryBudget
+{
+private:
+	size_t limit;
+	size_t used = 0;
+	size_t peak = 0;
+	size_t waits = 0;
+	mutable std::mutex mutex;
+	std::condition_variable cond;
+
+public:
+	// a limit of 0 disables the budget
+	explicit MemoryBudget(size_t limitIn): limit(limitIn)
+	{
+	}
+
+	bool isLimited() const
+	{
+		return limit > 0;
+	}
+
+	// returns the number of bytes that where granted, which must be released later
+	size_t acquire(size_t bytes)
+	{
+		if(limit == 0)
+			return 0;
+		bytes = std::min(bytes, limit);
+		std::unique_lock<std::mutex> lock(mutex);
+		if(used + bytes > limit)
+			++waits;
+		cond.wait(lock, [this, bytes](){return used + bytes <= limit;});
+		used += bytes;
+		peak = std::max(peak, used);
+		return bytes;
+	}
+
+	void release(size_t bytes)
+	{
+		if(bytes == 0)
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			used -= std::min(bytes, used);
+		}
+		cond.notify_all();
+	}
+
+	size_t getPeak() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return peak;
+	}
+
+	size_t getWaits() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return waits;
+	}
+};
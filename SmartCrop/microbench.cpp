@@ -0,0 +1,291 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <argp.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "log.h"
+#include "seamcarving.h"
+#include "yolo.h"
+#include "intelligentroi.h"
+
+// Times the hot kernels of seam carving, yolo post processing and the roi search in isolation
+// and writes the results as JSON.
+
+struct MicrobenchConfig
+{
+	std::filesystem::path outputPath;
+	std::filesystem::path image = BENCH_PERSON_IMAGE;
+	std::string filter;
+	double minTime = 0.5;
+};
+
+struct KernelResult
+{
+	std::string name;
+	cv::Size size;
+	size_t iterations;
+	double nsPerCall;
+	double nsPerPixel;
+	// bytes the kernel reads and writes per call, 0 where that is not meaningful
+	double bytes;
+};
+
+const char *argp_program_version = "AIImagePreprocesses";
+const char *argp_program_bug_address = "<carl@uvos.xyz>";
+static char doc[] = "Microbenchmarks of the SmartCrop kernels, results are written as JSON";
+static char args_doc[] = "";
+
+static struct argp_option options[] =
+{
+  {"output",		'o', "[FILENAME]",	0,	"write the JSON results to this file instead of stdout"},
+  {"image",		'i', "[FILENAME]",	0,	"image the yolo kernels are run on"},
+  {"filter",		'f', "[STRING]",	0,	"only run kernels whose name contains this string"},
+  {"min-time",		't', "[SECONDS]",	0,	"time each kernel is run for at least, default: 0.5"},
+  {0}
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
+{
+	MicrobenchConfig *config = reinterpret_cast<MicrobenchConfig*>(state->input);
+	try
+	{
+		switch (key)
+		{
+			case 'o':
+				config->outputPath = arg;
+				break;
+			case 'i':
+				config->image = arg;
+				break;
+			case 'f':
+				config->filter = arg;
+				break;
+			case 't':
+				config->minTime = std::stod(arg);
+				break;
+			case ARGP_KEY_ARG:
+				argp_usage(state);
+				break;
+			default:
+				return ARGP_ERR_UNKNOWN;
+		}
+	}
+	catch(const std::invalid_argument& ex)
+	{
+		std::cout<<arg<<" passed for argument -"<<static_cast<char>(key)<<" is not a valid number.\n";
+		return ARGP_KEY_ERROR;
+	}
+	return 0;
+}
+
+static struct argp argp = {options, parse_opt, args_doc, doc};
+
+static const cv::Size benchSizes[] =
+{
+	cv::Size(512, 512),
+	cv::Size(1024, 1024),
+	cv::Size(2048, 2048),
+	cv::Size(3840, 2160),
+	cv::Size(7680, 4320),
+};
+
+// friend of the classes whose kernels are benchmarked
+class KernelBench
+{
+private:
+	const MicrobenchConfig& config;
+	std::vector<KernelResult> results;
+
+	bool selected(const std::string& name) const
+	{
+		return config.filter.empty() || name.find(config.filter) != std::string::npos;
+	}
+
+	// runs the kernel until minTime has passed and records the median time per call
+	template<typename Kernel> void run(const std::string& name, const cv::Size& size, double bytes, Kernel kernel)
+	{
+		if(!selected(name))
+			return;
+
+		std::vector<double> times;
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		do
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			kernel();
+			times.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+		}
+		while(times.size() < 3 || std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() < config.minTime);
+
+		std::nth_element(times.begin(), times.begin() + times.size()/2, times.end());
+		KernelResult result;
+		result.name = name;
+		result.size = size;
+		result.iterations = times.size();
+		result.nsPerCall = times[times.size()/2];
+		result.nsPerPixel = result.nsPerCall/(static_cast<double>(size.width)*size.height);
+		result.bytes = bytes;
+		results.push_back(result);
+		std::cerr<<name<<' '<<size.width<<'x'<<size.height<<": "<<result.nsPerPixel<<" ns/pixel"<<std::endl;
+	}
+
+	void benchSeamCarving(const cv::Size& size)
+	{
+		cv::Mat image(size, CV_8UC3);
+		cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+		double pixels = static_cast<double>(size.width)*size.height;
+
+		cv::Mat gradient;
+		run("SeamCarving::computeGradientMagnitude", size, pixels*(3+4), [&](){gradient = SeamCarving::computeGradientMagnitude(image);});
+		if(gradient.empty())
+			gradient = SeamCarving::computeGradientMagnitude(image);
+
+		cv::Mat pathIntensity;
+		run("SeamCarving::computePathIntensityMat", size, pixels*(4+4), [&](){pathIntensity = SeamCarving::computePathIntensityMat(gradient);});
+		if(pathIntensity.empty())
+			pathIntensity = SeamCarving::computePathIntensityMat(gradient);
+
+		std::vector<int> seam;
+		// the seam is traced upwards reading three values per row
+		run("SeamCarving::getLeastImportantPath", size, (size.width + size.height*3)*4.0, [&](){seam = SeamCarving::getLeastImportantPath(pathIntensity);});
+		if(seam.empty())
+			seam = SeamCarving::getLeastImportantPath(pathIntensity);
+
+		cv::Mat carved;
+		run("SeamCarving::removeLeastImportantPath", size, pixels*3*2, [&](){carved = SeamCarving::removeLeastImportantPath(image, seam);});
+		run("SeamCarving::addLeastImportantPath", size, pixels*3*2, [&](){carved = SeamCarving::addLeastImportantPath(image, seam);});
+	}
+
+	void benchMaxRect(const cv::Size& size)
+	{
+		// the corners of a few boxes spread over the image, like the detections getCropRectangle passes
+		cv::RNG rng(1);
+		std::vector<std::pair<cv::Point2i, int>> points;
+		for(int i = 0; i < 8; ++i)
+		{
+			cv::Rect box(rng.uniform(0, size.width*3/4), rng.uniform(0, size.height*3/4), size.width/8, size.height/8);
+			int priority = rng.uniform(1, 10);
+			points.push_back({box.tl(), priority});
+			points.push_back({box.br(), priority});
+		}
+
+		cv::Rect rect;
+		bool incompleate;
+		run("InteligentRoi::maxRect", size, 0, [&](){rect = InteligentRoi::maxRect(incompleate, size, 1.0, points);});
+	}
+
+	void benchYolo()
+	{
+		if(!selected("Yolo::"))
+			return;
+
+		cv::Mat image = cv::imread(config.image);
+		if(image.empty())
+		{
+			Log(Log::WARN)<<"could not load "<<config.image<<", running yolo on noise";
+			image = cv::Mat(1080, 1920, CV_8UC3);
+			cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+		}
+
+		Yolo yolo("", {640, 480}, "", false);
+		cv::Mat blob;
+		cv::Size modelSize = yolo.getModelShape();
+		cv::dnn::blobFromImages(std::vector<cv::Mat>{image}, blob, 1.0/255.0, modelSize, cv::Scalar(), true, false);
+
+		std::vector<cv::Mat> outputs;
+		run("Yolo::forward", modelSize, blob.total()*blob.elemSize(), [&](){outputs = yolo.forward(blob);});
+		if(outputs.empty())
+			outputs = yolo.forward(blob);
+
+		cv::Mat output(outputs[0].size[1], outputs[0].size[2], CV_32F, outputs[0].ptr<float>(0));
+		std::vector<Yolo::Detection> detections;
+		run("Yolo::decodeOutput", modelSize, output.total()*output.elemSize(), [&](){detections = yolo.decodeOutput(output, image.size(), image.size());});
+	}
+
+public:
+	explicit KernelBench(const MicrobenchConfig& configIn): config(configIn)
+	{
+	}
+
+	void runAll()
+	{
+		for(const cv::Size& size : benchSizes)
+		{
+			benchSeamCarving(size);
+			benchMaxRect(size);
+		}
+		benchYolo();
+	}
+
+	void writeJson(std::ostream& out) const
+	{
+		out<<"[\n";
+		for(size_t i = 0; i < results.size(); ++i)
+		{
+			const KernelResult& result = results[i];
+			out<<"  {\"kernel\": \""<<result.name<<"\", \"width\": "<<result.size.width<<", \"height\": "<<result.size.height
+				<<", \"iterations\": "<<result.iterations<<", \"nsPerCall\": "<<result.nsPerCall<<", \"nsPerPixel\": "<<result.nsPerPixel
+				<<", \"GBps\": ";
+			if(result.bytes > 0)
+				out<<result.bytes/result.nsPerCall;
+			else
+				out<<"null";
+			out<<"}"<<(i+1 < results.size() ? "," : "")<<'\n';
+		}
+		out<<"]\n";
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	MicrobenchConfig config;
+	argp_parse(&argp, argc, argv, 0, 0, &config);
+	// stdout may carry the results
+	Log::toStderr = true;
+	Log::level = Log::WARN;
+
+	KernelBench bench(config);
+	bench.runAll();
+
+	if(config.outputPath.empty())
+	{
+		bench.writeJson(std::cout);
+	}
+	else
+	{
+		std::ofstream file(config.outputPath);
+		if(!file.is_open())
+		{
+			Log(Log::ERROR)<<"could not open "<<config.outputPath<<" for writing";
+			return 1;
+		}
+		bench.writeJson(file);
+	}
+	return 0;
+}
@@ -25,12 +25,51 @@
 #include <filesystem>
 #include <opencv2/core/types.hpp>
 #include "log.h"
+#include "config.h"
+#include "tokenize.h"
+#include "socketio.h"
 
 const char *argp_program_version = "AIImagePreprocesses";
 const char *argp_program_bug_address = "<carl@uvos.xyz>";
 static char doc[] = "Application that trainsforms images into formats, sizes and aspect ratios required for ai training";
 static char args_doc[] = "FILE(S)";
 
+enum
+{
+	OPT_DECODE_THREADS = 256,
+	OPT_CROP_THREADS,
+	OPT_ENCODE_THREADS,
+	OPT_QUEUE_DEPTH,
+	OPT_BATCH_SIZE,
+	OPT_PROXY_SIZE,
+	OPT_JOURNAL,
+	OPT_RESUME,
+	OPT_JOURNAL_HASH,
+	OPT_DETECTION_CACHE,
+	OPT_BUCKETS,
+	OPT_CRAWL_THREADS,
+	OPT_SHARD,
+	OPT_SERVE_QUEUE,
+	OPT_WORKER,
+	OPT_LEASE_SIZE,
+	OPT_LEASE_TIMEOUT,
+	OPT_OUTPUT_TAR,
+	OPT_PACKED,
+	OPT_READ_AHEAD,
+	OPT_KEEP_PAGE_CACHE,
+	OPT_JPEG_QUALITY,
+	OPT_PNG_COMPRESSION,
+	OPT_WEBP_QUALITY,
+	OPT_FORMAT,
+	OPT_DURABLE,
+	OPT_MAX_INFLIGHT_MEM,
+	OPT_MAT_ALLOCATOR,
+	OPT_MAT_POOL_SIZE,
+	OPT_DEDUP,
+	OPT_DAEMON,
+	OPT_STREAM,
+};
+
 static struct argp_option options[] =
 {
   {"verbose",		'v', 0,				0,	"Show debug messages" },
@@ -40,25 +79,104 @@ static struct argp_option options[] =
   {"out",	 		'o', "[DIRECTORY]",	0,	"directory whre images are to be saved" },
   {"debug", 		'd', 0,				0,	"output debug images" },
   {"seam-carving", 	's', 0,				0,	"use seam carving to change image aspect ratio instead of croping"},
-  {"x-size", 		'x', "[PIXELS]",	0,	"target output width, default: 1024"},
-  {"y-size", 		'y', "[PIXELS]",	0,	"target output height, default: 1024"},
+  {"x-size", 		'x', "[PIXELS]",	0,	"target output width, a comma seperated list produces one output per size, default: 1024"},
+  {"y-size", 		'y', "[PIXELS]",	0,	"target output height, a comma seperated list produces one output per size, default: 1024"},
   {"focus-person",	'f', "[FILENAME]",	0,	"a file name to an image of a person that the crop should focus on"},
   {"person-threshold",	't', "[NUMBER]",	0,	"the threshold at witch to consider a person matched, defaults to 0.363"},
+  {"threads",		'j', "[NUMBER]",	0,	"number of detection threads, each with its own model instance, default: 1"},
+  {"crawl-threads",	OPT_CRAWL_THREADS, "[NUMBER]",	0,	"number of threads walking the input directories, default: 4"},
+  {"decode-threads",	OPT_DECODE_THREADS, "[NUMBER]",	0,	"number of threads loading images, default: 1"},
+  {"crop-threads",	OPT_CROP_THREADS, "[NUMBER]",	0,	"number of threads croping and seam carving images, default: 1"},
+  {"encode-threads",	OPT_ENCODE_THREADS, "[NUMBER]",	0,	"number of threads saving images, default: 1"},
+  {"queue-depth",	OPT_QUEUE_DEPTH, "[NUMBER]",	0,	"number of images that may wait between each processing stage, default: 4"},
+  {"batch",		OPT_BATCH_SIZE, "[NUMBER]",	0,	"number of images to run detection on at once, default: 1"},
+  {"journal",		OPT_JOURNAL, "[FILENAME]",	0,	"journal of finished images used to resume interrupted runs, default: smartcrop.journal in the output directory"},
+  {"resume",		OPT_RESUME, "[MODE]",	0,	"which journal entries allow an image to be skipped: off, input (the input is unchanged) or config (the input and the output affecting options are unchanged), default: config"},
+  {"journal-hash",	OPT_JOURNAL_HASH, 0,	0,	"identify inputs in the journal by a hash of their content instead of their modification time"},
+  {"detection-cache",	OPT_DETECTION_CACHE, "[FILENAME]",	0,	"cache detection results in this file so that later runs on the same images can skip detection"},
+  {"buckets",		OPT_BUCKETS, "[WxH,...]",	0,	"aspect ratio buckets, each image is croped to the one bucket that keeps the most content with the least scaling, overrides -x and -y"},
+  {"shard",		OPT_SHARD, "[INDEX/COUNT]",	0,	"only process the images whose path hashes to shard INDEX of COUNT, INDEX counts from 0"},
+  {"serve-queue",	OPT_SERVE_QUEUE, "[PORT]",	OPTION_ARG_OPTIONAL,	"act as coordinator, enumerate the inputs and hand them out to workers over TCP instead of processing them, default port: 7070"},
+  {"worker",		OPT_WORKER, "[HOST:PORT]",	0,	"act as worker, process the images handed out by the coordinator at this address"},
+  {"lease-size",	OPT_LEASE_SIZE, "[NUMBER]",	0,	"number of images a worker requests from the coordinator at once, default: 16"},
+  {"lease-timeout",	OPT_LEASE_TIMEOUT, "[SECONDS]",	0,	"time after which the coordinator hands out images again that where not acked, default: 300"},
+  {"output-tar",	OPT_OUTPUT_TAR, "[MEGABYTES]",	OPTION_ARG_OPTIONAL,	"write the output images into tar shards of at most this size instead of individual files, default size: 1024"},
+  {"packed",		OPT_PACKED, 0,	0,	"write the output images as raw RGB tensors into one memory mappable file per output size instead of individual files"},
+  {"read-ahead",	OPT_READ_AHEAD, "[NUMBER]",	0,	"number of queued images per decode thread to start reading in the background, 0 to disable, default: 4"},
+  {"keep-page-cache",	OPT_KEEP_PAGE_CACHE, 0,	0,	"leave the input images in the page cache after they have been decoded"},
+  {"jpeg-quality",	OPT_JPEG_QUALITY, "[0-100]",	0,	"quality of jpeg outputs, default: 95"},
+  {"png-compression",	OPT_PNG_COMPRESSION, "[0-9]",	0,	"compression level of png outputs, lower is faster, default: 1"},
+  {"webp-quality",	OPT_WEBP_QUALITY, "[0-101]",	0,	"quality of webp outputs, 101 is lossless, default: lossless"},
+  {"format",		OPT_FORMAT, "[EXTENSION]",	0,	"format the outputs are encoded in, given by its file extension e.g. jpg, png or webp, default: the format of the input"},
+  {"durable",		OPT_DURABLE, "[NUMBER]",	OPTION_ARG_OPTIONAL,	"sync outputs to disk with syncfs after this many images, and at least every 5 seconds, before they are recorded in the journal, default: 256"},
+  {"max-inflight-mem",	OPT_MAX_INFLIGHT_MEM, "[BYTES]",	0,	"limit the estimated memory held by images in flight, accepts K, M and G suffixes, default: unlimited"},
+  {"dedup",		OPT_DEDUP, "[BITS]",	OPTION_ARG_OPTIONAL,	"skip exact copies and images whose perceptual hash differs by at most this many bits from one already seen, default: 6"},
+  {"daemon",		OPT_DAEMON, "[SOCKET]",	0,	"keep the models loaded and serve crop requests on this UNIX socket instead of processing the inputs"},
+  {"stream",		OPT_STREAM, 0,	0,	"read newline delimited JSON jobs from stdin and write one JSON result per image to stdout instead of processing the inputs"},
+  {"mat-allocator",	OPT_MAT_ALLOCATOR, "[MODE]",	0,	"allocator for image buffers, std, pool to reuse buffers per thread or pool-huge to also back them with huge pages, default: std"},
+  {"mat-pool-size",	OPT_MAT_POOL_SIZE, "[BYTES]",	0,	"bytes of free image buffers the pool allocator keeps for reuse, accepts K, M and G suffixes, default: 512M"},
+  {"proxy-size",	OPT_PROXY_SIZE, "[PIXELS]",	0,	"run detection on a proxy image with this long side and crop the output from the full resolution image, default: disabled"},
   {0}
 };
 
-struct Config
+// sets the width or height of the target sizes from a comma seperated list, a single value applies to all sizes
+static bool parseSizeList(const std::string& arg, std::vector<cv::Size>& sizes, bool width)
 {
-	std::vector<std::filesystem::path> imagePaths;
-	std::filesystem::path modelPath;
-	std::filesystem::path classesPath;
-	std::filesystem::path outputDir;
-	std::filesystem::path focusPersonImage;
-	bool seamCarving = false;
-	bool debug = false;
-	double threshold = 0.363;
-	cv::Size targetSize = cv::Size(1024, 1024);
-};
+	std::vector<std::string> tokens = tokenizeBinaryIgnore(arg, ',');
+	if(tokens.size() > 1 && sizes.size() > 1 && tokens.size() != sizes.size())
+		return false;
+	if(tokens.size() > sizes.size())
+		sizes.resize(tokens.size(), sizes.back());
+	for(size_t i = 0; i < sizes.size(); ++i)
+	{
+		int value = std::stoi(tokens[tokens.size() == 1 ? 0 : i]);
+		if(value < 1)
+			return false;
+		if(width)
+			sizes[i].width = value;
+		else
+			sizes[i].height = value;
+	}
+	return true;
+}
+
+// parses a byte count with an optional K, M or G suffix
+static bool parseByteSize(const std::string& arg, size_t& bytes)
+{
+	size_t pos;
+	long long value = std::stoll(arg, &pos);
+	if(value < 0)
+		return false;
+	std::string suffix = arg.substr(pos);
+	size_t multiplier = 1;
+	if(suffix == "K" || suffix == "k")
+		multiplier = 1024;
+	else if(suffix == "M" || suffix == "m")
+		multiplier = 1024*1024;
+	else if(suffix == "G" || suffix == "g")
+		multiplier = 1024*1024*1024;
+	else if(!suffix.empty())
+		return false;
+	bytes = value*multiplier;
+	return true;
+}
+
+// parses a comma seperated list of WIDTHxHEIGHT sizes
+static bool parseBucketList(const std::string& arg, std::vector<cv::Size>& buckets)
+{
+	buckets.clear();
+	for(const std::string& token : tokenizeBinaryIgnore(arg, ','))
+	{
+		std::vector<std::string> dimensions = tokenizeBinaryIgnore(token, 'x');
+		if(dimensions.size() != 2)
+			return false;
+		cv::Size size(std::stoi(dimensions[0]), std::stoi(dimensions[1]));
+		if(size.width < 1 || size.height < 1)
+			return false;
+		buckets.push_back(size);
+	}
+	return !buckets.empty();
+}
 
 static error_t parse_opt (int key, char *arg, struct argp_state *state)
 {
@@ -94,18 +212,237 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 		case 't':
 			config->threshold = std::atof(arg);
 			break;
-		case 'x':
+		case 'j':
+		case OPT_CRAWL_THREADS:
+		case OPT_LEASE_SIZE:
+		case OPT_LEASE_TIMEOUT:
+		case OPT_DECODE_THREADS:
+		case OPT_CROP_THREADS:
+		case OPT_ENCODE_THREADS:
+		case OPT_QUEUE_DEPTH:
+		case OPT_BATCH_SIZE:
 		{
-			int x = std::stoi(arg);
-			config->targetSize = cv::Size(x, config->targetSize.height);
+			int count = std::stoi(arg);
+			if(count < 1)
+			{
+				std::cout<<arg<<" is not a valid count, it must be at least 1\n";
+				return ARGP_KEY_ERROR;
+			}
+			if(key == 'j')
+				config->detectThreads = count;
+			else if(key == OPT_CRAWL_THREADS)
+				config->crawlThreads = count;
+			else if(key == OPT_LEASE_SIZE)
+				config->leaseSize = count;
+			else if(key == OPT_LEASE_TIMEOUT)
+				config->leaseTimeout = count;
+			else if(key == OPT_DECODE_THREADS)
+				config->decodeThreads = count;
+			else if(key == OPT_CROP_THREADS)
+				config->cropThreads = count;
+			else if(key == OPT_ENCODE_THREADS)
+				config->encodeThreads = count;
+			else if(key == OPT_QUEUE_DEPTH)
+				config->queueDepth = count;
+			else
+				config->batchSize = count;
 			break;
 		}
-		case 'y':
+		case OPT_JOURNAL:
+			config->journalPath = arg;
+			break;
+		case OPT_RESUME:
+		{
+			std::string mode(arg);
+			if(mode == "off")
+				config->resume = Config::RESUME_OFF;
+			else if(mode == "input")
+				config->resume = Config::RESUME_INPUT;
+			else if(mode == "config")
+				config->resume = Config::RESUME_CONFIG;
+			else
+			{
+				std::cout<<arg<<" is not a valid resume mode, valid modes are off, input and config\n";
+				return ARGP_KEY_ERROR;
+			}
+			break;
+		}
+		case OPT_JOURNAL_HASH:
+			config->journalHash = true;
+			break;
+		case OPT_DETECTION_CACHE:
+			config->detectionCachePath = arg;
+			break;
+		case OPT_BUCKETS:
+			if(!parseBucketList(arg, config->buckets))
+			{
+				std::cout<<arg<<" is not a valid list of buckets, expected a comma seperated list like 1024x1024,1152x896\n";
+				return ARGP_KEY_ERROR;
+			}
+			break;
+		case OPT_SHARD:
+		{
+			std::vector<std::string> tokens = tokenizeBinaryIgnore(arg, '/');
+			if(tokens.size() != 2 || std::stoi(tokens[0]) < 0 || std::stoi(tokens[1]) < 1 || std::stoi(tokens[0]) >= std::stoi(tokens[1]))
+			{
+				std::cout<<arg<<" is not a valid shard, expected INDEX/COUNT with INDEX smaller than COUNT\n";
+				return ARGP_KEY_ERROR;
+			}
+			config->shardIndex = std::stoi(tokens[0]);
+			config->shardCount = std::stoi(tokens[1]);
+			break;
+		}
+		case OPT_SERVE_QUEUE:
+		{
+			std::string host;
+			config->serveQueuePort = 7070;
+			if(arg && !parseHostPort(arg, host, config->serveQueuePort))
+			{
+				std::cout<<arg<<" is not a valid port\n";
+				return ARGP_KEY_ERROR;
+			}
+			break;
+		}
+		case OPT_JPEG_QUALITY:
+		case OPT_PNG_COMPRESSION:
+		case OPT_WEBP_QUALITY:
 		{
-			int y = std::stoi(arg);
-			config->targetSize = cv::Size(config->targetSize.width, y);
+			int value = std::stoi(arg);
+			int max = key == OPT_PNG_COMPRESSION ? 9 : key == OPT_JPEG_QUALITY ? 100 : 101;
+			if(value < 0 || value > max)
+			{
+				std::cout<<arg<<" is out of range, it must be between 0 and "<<max<<'\n';
+				return ARGP_KEY_ERROR;
+			}
+			if(key == OPT_JPEG_QUALITY)
+				config->jpegQuality = value;
+			else if(key == OPT_PNG_COMPRESSION)
+				config->pngCompression = value;
+			else
+				config->webpQuality = value;
 			break;
 		}
+		case OPT_FORMAT:
+			config->outputFormat = arg;
+			if(!config->outputFormat.empty() && config->outputFormat[0] != '.')
+				config->outputFormat.insert(0, 1, '.');
+			break;
+		case OPT_DURABLE:
+		{
+			config->durable = true;
+			if(arg)
+			{
+				int count = std::stoi(arg);
+				if(count < 1)
+				{
+					std::cout<<arg<<" is not a valid count, it must be at least 1\n";
+					return ARGP_KEY_ERROR;
+				}
+				config->syncInterval = count;
+			}
+			break;
+		}
+		case OPT_MAX_INFLIGHT_MEM:
+			if(!parseByteSize(arg, config->maxInflightMem))
+			{
+				std::cout<<arg<<" is not a valid size, expected a number of bytes optionally followed by K, M or G\n";
+				return ARGP_KEY_ERROR;
+			}
+			break;
+		case OPT_DEDUP:
+		{
+			config->dedupRadius = 6;
+			if(arg)
+			{
+				int radius = std::stoi(arg);
+				if(radius < 0 || radius > 64)
+				{
+					std::cout<<arg<<" is out of range, it must be between 0 and 64\n";
+					return ARGP_KEY_ERROR;
+				}
+				config->dedupRadius = radius;
+			}
+			break;
+		}
+		case OPT_MAT_ALLOCATOR:
+		{
+			std::string mode(arg);
+			if(mode == "std")
+				config->matAllocator = Config::MAT_ALLOCATOR_STD;
+			else if(mode == "pool")
+				config->matAllocator = Config::MAT_ALLOCATOR_POOL;
+			else if(mode == "pool-huge")
+				config->matAllocator = Config::MAT_ALLOCATOR_POOL_HUGE;
+			else
+			{
+				std::cout<<arg<<" is not a valid allocator, valid allocators are std, pool and pool-huge\n";
+				return ARGP_KEY_ERROR;
+			}
+			break;
+		}
+		case OPT_MAT_POOL_SIZE:
+			if(!parseByteSize(arg, config->matPoolSize))
+			{
+				std::cout<<arg<<" is not a valid size, expected a number of bytes optionally followed by K, M or G\n";
+				return ARGP_KEY_ERROR;
+			}
+			break;
+		case OPT_READ_AHEAD:
+		{
+			int count = std::stoi(arg);
+			if(count < 0)
+			{
+				std::cout<<arg<<" is not a valid count\n";
+				return ARGP_KEY_ERROR;
+			}
+			config->readAhead = count;
+			break;
+		}
+		case OPT_KEEP_PAGE_CACHE:
+			config->keepPageCache = true;
+			break;
+		case OPT_PACKED:
+			config->packedOutput = true;
+			break;
+		case OPT_OUTPUT_TAR:
+		{
+			int size = arg ? std::stoi(arg) : 1024;
+			if(size < 1)
+			{
+				std::cout<<arg<<" is not a valid shard size\n";
+				return ARGP_KEY_ERROR;
+			}
+			config->outputTarSize = static_cast<uint64_t>(size)*1024*1024;
+			break;
+		}
+		case OPT_WORKER:
+			config->workerAddress = arg;
+			break;
+		case OPT_DAEMON:
+			config->daemonSocket = arg;
+			break;
+		case OPT_STREAM:
+			config->streamJobs = true;
+			break;
+		case OPT_PROXY_SIZE:
+		{
+			int size = std::stoi(arg);
+			if(size < 1)
+			{
+				std::cout<<arg<<" is out of range, it must be at least 1\n";
+				return ARGP_KEY_ERROR;
+			}
+			config->proxySize = size;
+			break;
+		}
+		case 'x':
+		case 'y':
+			if(!parseSizeList(arg, config->targetSizes, key == 'x'))
+			{
+				std::cout<<arg<<" is not a valid list of sizes, the number of widths and heights must match\n";
+				return ARGP_KEY_ERROR;
+			}
+			break;
 		case ARGP_KEY_ARG:
 			config->imagePaths.push_back(arg);
 			break;
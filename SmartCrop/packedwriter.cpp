@@ -0,0 +1,183 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "packedwriter.h"
+
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <opencv2/imgproc.hpp>
+
+#include "tokenize.h"
+#include "log.h"
+
+static bool pwriteAll(int fd, const void* data, size_t size, uint64_t offset)
+{
+	const char* pos = static_cast<const char*>(data);
+	while(size > 0)
+	{
+		ssize_t ret = pwrite(fd, pos, size, offset);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		pos += ret;
+		size -= ret;
+		offset += ret;
+	}
+	return true;
+}
+
+template<typename T>
+static void putLittleEndian(unsigned char* out, T value)
+{
+	for(size_t i = 0; i < sizeof(T); ++i)
+		out[i] = static_cast<unsigned char>(value >> (i*8));
+}
+
+PackedWriter::PackedWriter(const std::filesystem::path& prefix, const cv::Size& sizeIn):
+	size(sizeIn), recordSize(static_cast<uint64_t>(sizeIn.width)*sizeIn.height*3)
+{
+	path = prefix.string() + ".scpk";
+	for(size_t i = 1; std::filesystem::exists(path); ++i)
+		path = prefix.string() + '-' + std::to_string(i) + ".scpk";
+
+	fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if(fd < 0)
+	{
+		Log(Log::ERROR)<<"could not create "<<path<<": "<<std::strerror(errno);
+		return;
+	}
+	if(!writeHeader(0, 0, 0))
+	{
+		Log(Log::ERROR)<<"could not write to "<<path<<": "<<std::strerror(errno);
+		::close(fd);
+		fd = -1;
+	}
+}
+
+PackedWriter::~PackedWriter()
+{
+	close();
+}
+
+bool PackedWriter::isOpen() const
+{
+	return fd >= 0;
+}
+
+const std::filesystem::path& PackedWriter::getPath() const
+{
+	return path;
+}
+
+bool PackedWriter::writeHeader(uint64_t count, uint64_t indexOffset, uint64_t indexSize)
+{
+	unsigned char header[dataOffset] = {};
+	std::memcpy(header, "SCPK", 4);
+	putLittleEndian<uint32_t>(header+4, version);
+	putLittleEndian<uint32_t>(header+8, size.width);
+	putLittleEndian<uint32_t>(header+12, size.height);
+	putLittleEndian<uint32_t>(header+16, 3);
+	putLittleEndian<uint32_t>(header+20, 0);
+	putLittleEndian<uint64_t>(header+24, recordSize);
+	putLittleEndian<uint64_t>(header+32, count);
+	putLittleEndian<uint64_t>(header+40, dataOffset);
+	putLittleEndian<uint64_t>(header+48, indexOffset);
+	putLittleEndian<uint64_t>(header+56, indexSize);
+	return pwriteAll(fd, header, sizeof(header), 0);
+}
+
+void PackedWriter::allocate(uint64_t record)
+{
+	if(record < allocatedRecords)
+		return;
+
+	std::lock_guard<std::mutex> lock(allocateMutex);
+	uint64_t allocated = allocatedRecords;
+	if(record < allocated)
+		return;
+
+	// grow in steps of a quarter of the file, so the file system can lay the file out contiguously
+	uint64_t target = std::max(record+1, allocated + std::max<uint64_t>(allocated/4, 64));
+	int ret = posix_fallocate(fd, dataOffset + allocated*recordSize, (target-allocated)*recordSize);
+	if(ret != 0 && ret != EOPNOTSUPP)
+		Log(Log::WARN)<<"could not preallocate "<<path<<": "<<std::strerror(ret);
+	allocatedRecords = target;
+}
+
+int64_t PackedWriter::append(const cv::Mat& image, const std::filesystem::path& source)
+{
+	if(fd < 0 || image.size() != size || image.depth() != CV_8U)
+		return -1;
+
+	cv::Mat rgb;
+	if(image.channels() == 1)
+		cv::cvtColor(image, rgb, cv::COLOR_GRAY2RGB);
+	else if(image.channels() == 4)
+		cv::cvtColor(image, rgb, cv::COLOR_BGRA2RGB);
+	else
+		cv::cvtColor(image, rgb, cv::COLOR_BGR2RGB);
+
+	uint64_t record = nextRecord++;
+	allocate(record);
+	bool ret = pwriteAll(fd, rgb.data, recordSize, dataOffset + record*recordSize);
+
+	{
+		std::lock_guard<std::mutex> lock(indexMutex);
+		if(index.size() <= record)
+			index.resize(record+1);
+		if(ret)
+			index[record] = source.string();
+	}
+
+	if(!ret)
+	{
+		Log(Log::WARN)<<"could not write record "<<record<<" of "<<path<<": "<<std::strerror(errno);
+		return -1;
+	}
+	return record;
+}
+
+void PackedWriter::close()
+{
+	if(fd < 0)
+		return;
+
+	uint64_t count = nextRecord;
+	index.resize(count);
+	std::string indexData;
+	for(const std::string& entry : index)
+		indexData.append(escapeSeperators(entry)).push_back('\n');
+
+	uint64_t indexOffset = dataOffset + count*recordSize;
+	if(ftruncate(fd, indexOffset) != 0 || !pwriteAll(fd, indexData.data(), indexData.size(), indexOffset) ||
+		!writeHeader(count, indexOffset, indexData.size()) || fsync(fd) != 0)
+		Log(Log::ERROR)<<"could not finish "<<path<<": "<<std::strerror(errno);
+	else
+		Log(Log::INFO)<<"Wrote "<<count<<" images to "<<path;
+
+	::close(fd);
+	fd = -1;
+}
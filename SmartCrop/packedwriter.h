@@ -0,0 +1,71 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+// Writes images of one fixed size as raw uint8 HWC RGB tensors into a single file that
+// trainers can mmap. Layout, all integers little endian:
+//
+//   0     "SCPK", uint32 version, uint32 width, uint32 height, uint32 channels, uint32 flags,
+//         uint64 recordSize, uint64 count, uint64 dataOffset, uint64 indexOffset, uint64 indexSize
+//   4096  count records of recordSize bytes
+//   index count newline terminated source paths escaped with escapeSeperators(), in record order
+//
+// count and indexOffset stay 0 until close() so an incomplete file is recognizable, close() also syncs
+// the file to disk. Appends claim a record with an atomic counter and write it with pwrite, so workers
+// do not serialize on the data.
+// Records whose write failed have an empty path in the index.
+class PackedWriter
+{
+public:
+	static constexpr uint32_t version = 1;
+	static constexpr uint64_t dataOffset = 4096;
+
+private:
+	int fd = -1;
+	std::filesystem::path path;
+	cv::Size size;
+	uint64_t recordSize;
+	std::atomic<uint64_t> nextRecord = 0;
+	std::atomic<uint64_t> allocatedRecords = 0;
+	std::mutex allocateMutex;
+	std::mutex indexMutex;
+	std::vector<std::string> index;
+
+	void allocate(uint64_t record);
+	bool writeHeader(uint64_t count, uint64_t indexOffset, uint64_t indexSize);
+
+public:
+	// the file is created as the first of PREFIX.scpk, PREFIX-1.scpk, ... that does not exist yet
+	PackedWriter(const std::filesystem::path& prefix, const cv::Size& size);
+	~PackedWriter();
+	bool isOpen() const;
+	const std::filesystem::path& getPath() const;
+	// returns the record the image was written to or -1 on failure
+	int64_t append(const cv::Mat& image, const std::filesystem::path& source);
+	void close();
+};
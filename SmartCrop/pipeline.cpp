@@ -0,0 +1,1271 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <filesystem>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cctype>
+
+#include "pipeline.h"
+#include "log.h"
+#include "intelligentroi.h"
+#include "seamcarving.h"
+#include "imageloader.h"
+#include "hash.h"
+#include "matpool.h"
+
+const Yolo::Detection* pointInDetectionHoriz(int x, const std::vector<Yolo::Detection>& detections, const Yolo::Detection* ignore = nullptr)
+{
+	const Yolo::Detection* inDetection = nullptr;
+	for(const Yolo::Detection& detection : detections)
+	{
+		if(ignore && ignore == &detection)
+			continue;
+
+		if(detection.box.x <= x && detection.box.x+detection.box.width >= x)
+		{
+			if(!inDetection || detection.box.br().x > inDetection->box.br().x)
+			inDetection = &detection;
+		}
+	}
+	return inDetection;
+}
+
+bool findRegionEndpointHoriz(int& x, const std::vector<Yolo::Detection>& detections, int imgSizeX)
+{
+	const Yolo::Detection* inDetection = pointInDetectionHoriz(x, detections);
+
+	Log(Log::DEBUG, false)<<__func__<<" point "<<x;
+
+	if(!inDetection)
+	{
+		const Yolo::Detection* closest = nullptr;
+		for(const Yolo::Detection& detection : detections)
+		{
+			if(detection.box.x > x)
+			{
+				if(closest == nullptr || detection.box.x-x > closest->box.x-x)
+					closest = &detection;
+			}
+		}
+		if(closest)
+			x = closest->box.x;
+		else
+			x = imgSizeX;
+
+		Log(Log::DEBUG)<<" is not in any box and will be moved to "<<x<<" where the closest box ("<<(closest ? closest->className : "null")<<") is";
+		return false;
+	}
+	else
+	{
+		x = inDetection->box.br().x;
+		Log(Log::DEBUG, false)<<" is in a box and will be moved to its end "<<x<<" where ";
+		const Yolo::Detection* candidateDetection = pointInDetectionHoriz(x, detections, inDetection);
+		if(candidateDetection && candidateDetection->box.br().x > x)
+		{
+			Log(Log::DEBUG)<<"it is again in a box";
+			return findRegionEndpointHoriz(x, detections, imgSizeX);
+		}
+		else
+		{
+			Log(Log::DEBUG)<<"it is not in a box";
+			return true;
+		}
+	}
+}
+
+std::vector<std::pair<cv::Mat, bool>> cutImageIntoHorzRegions(cv::Mat& image, const std::vector<Yolo::Detection>& detections)
+{
+	std::vector<std::pair<cv::Mat, bool>> out;
+
+	Log(Log::DEBUG)<<__func__<<' '<<image.cols<<'x'<<image.rows;
+
+	for(int x = 0; x < image.cols; ++x)
+	{
+		int start = x;
+		bool frozen = findRegionEndpointHoriz(x, detections, image.cols);
+
+		int width = x-start;
+		if(x < image.cols)
+			++width;
+		cv::Rect rect(start, 0, width, image.rows);
+		Log(Log::DEBUG)<<__func__<<" region\t"<<rect;
+		cv::Mat slice = image(rect);
+		out.push_back({slice, frozen});
+	}
+
+	return out;
+}
+
+cv::Mat assembleFromSlicesHoriz(const std::vector<std::pair<cv::Mat, bool>>& slices)
+{
+	assert(!slices.empty());
+
+	int cols = 0;
+	for(const std::pair<cv::Mat, bool>& slice : slices)
+		cols += slice.first.cols;
+
+
+	cv::Mat image(cols, slices[0].first.rows, slices[0].first.type());
+	Log(Log::DEBUG)<<__func__<<' '<<image.size()<<' '<<cols<<' '<<slices[0].first.rows;
+
+	int col = 0;
+	for(const std::pair<cv::Mat, bool>& slice : slices)
+	{
+		cv::Rect rect(col, 0, slice.first.cols, slice.first.rows);
+		Log(Log::DEBUG)<<__func__<<' '<<rect;
+		slice.first.copyTo(image(rect));
+		col += slice.first.cols-1;
+	}
+
+	return image;
+}
+
+void transposeRect(cv::Rect& rect)
+{
+	int x = rect.x;
+	rect.x = rect.y;
+	rect.y = x;
+
+	int width = rect.width;
+	rect.width = rect.height;
+	rect.height = width;
+}
+
+bool seamCarveResize(cv::Mat& image, std::vector<Yolo::Detection> detections, double targetAspectRatio = 1.0)
+{
+	detections.erase(std::remove_if(detections.begin(), detections.end(), [](const Yolo::Detection& detection){return detection.priority < 3;}), detections.end());
+
+	double aspectRatio = image.cols/static_cast<double>(image.rows);
+
+	Log(Log::DEBUG)<<"Image size "<<image.size()<<" aspect ratio "<<aspectRatio<<" target aspect ratio "<<targetAspectRatio;
+
+	bool vertical = false;
+	if(aspectRatio > targetAspectRatio)
+		vertical = true;
+
+	int requiredLines = 0;
+	if(!vertical)
+		requiredLines = image.rows*targetAspectRatio - image.cols;
+	else
+		requiredLines = image.cols/targetAspectRatio - image.rows;
+
+	Log(Log::DEBUG)<<__func__<<' '<<requiredLines<<" lines are required in "<<(vertical ? "vertical" : "horizontal")<<" direction";
+
+	if(vertical)
+	{
+		cv::transpose(image, image);
+		for(Yolo::Detection& detection : detections)
+			transposeRect(detection.box);
+	}
+
+	std::vector<std::pair<cv::Mat, bool>> slices = cutImageIntoHorzRegions(image, detections);
+	Log(Log::DEBUG)<<"Image has "<<slices.size()<<" slices:";
+	int totalResizableSize = 0;
+	for(const std::pair<cv::Mat, bool>& slice : slices)
+	{
+		Log(Log::DEBUG)<<"a "<<(slice.second ? "frozen" : "unfrozen")<<" slice of size "<<slice.first.cols;
+		if(!slice.second)
+			totalResizableSize += slice.first.cols;
+	}
+
+	if(totalResizableSize < requiredLines+1)
+	{
+		Log(Log::WARN)<<"Unable to seam carve as there are only "<<totalResizableSize<<" unfrozen cols";
+		if(vertical)
+			cv::transpose(image, image);
+		return false;
+	}
+
+	std::vector<int> seamsForSlice(slices.size(), 0);
+	for(size_t i = 0; i < slices.size(); ++i)
+	{
+		if(!slices[i].second)
+			seamsForSlice[i] = (static_cast<double>(slices[i].first.cols)/totalResizableSize)*requiredLines;
+	}
+
+	int residual = requiredLines - std::accumulate(seamsForSlice.begin(), seamsForSlice.end(), decltype(seamsForSlice)::value_type(0));;
+	for(ssize_t i = slices.size()-1; i >= 0; --i)
+	{
+		if(!slices[i].second)
+		{
+			seamsForSlice[i] += residual;
+			break;
+		}
+	}
+
+	for(size_t i = 0; i < slices.size(); ++i)
+	{
+		if(seamsForSlice[i] != 0)
+		{
+			bool ret = SeamCarving::strechImage(slices[i].first, seamsForSlice[i], true);
+			if(!ret)
+			{
+				if(vertical)
+					transpose(image, image);
+				return false;
+			}
+		}
+	}
+
+	image = assembleFromSlicesHoriz(slices);
+
+	if(vertical)
+		cv::transpose(image, image);
+
+	return true;
+}
+
+void drawDebugInfo(cv::Mat &image, const cv::Rect& rect, const std::vector<Yolo::Detection>& detections)
+{
+	for(const Yolo::Detection& detection : detections)
+	{
+		cv::rectangle(image, detection.box, detection.color, 3);
+		std::string label = detection.className + ' ' + std::to_string(detection.confidence).substr(0, 4) + ' ' + std::to_string(detection.priority);
+		cv::Size labelSize = cv::getTextSize(label, cv::FONT_HERSHEY_DUPLEX, 1, 1, 0);
+		cv::Rect textBox(detection.box.x, detection.box.y - 40, labelSize.width + 10, labelSize.height + 20);
+		cv::rectangle(image, textBox, detection.color, cv::FILLED);
+		cv::putText(image, label, cv::Point(detection.box.x + 5, detection.box.y - 10), cv::FONT_HERSHEY_DUPLEX, 1, cv::Scalar(0, 0, 0), 1, 0);
+	}
+
+	cv::rectangle(image, rect, cv::Scalar(0, 0, 255), 8);
+}
+
+static void reduceLongSide(cv::Mat& image, int longTargetSize)
+{
+	if(std::max(image.cols, image.rows) > longTargetSize)
+	{
+		if(image.cols > image.rows)
+		{
+			double ratio = static_cast<double>(longTargetSize)/image.cols;
+			cv::resize(image, image, {longTargetSize, static_cast<int>(image.rows*ratio)}, 0, 0, ratio < 1 ? cv::INTER_AREA : cv::INTER_CUBIC);
+		}
+		else
+		{
+			double ratio = static_cast<double>(longTargetSize)/image.rows;
+			cv::resize(image, image, {static_cast<int>(image.cols*ratio), longTargetSize}, 0, 0, ratio < 1 ? cv::INTER_AREA : cv::INTER_CUBIC);
+		}
+	}
+}
+
+static void scaleRect(cv::Rect& rect, double factor)
+{
+	rect = cv::Rect(std::lround(rect.x*factor), std::lround(rect.y*factor), std::lround(rect.width*factor), std::lround(rect.height*factor));
+}
+
+static const cv::Size modelInputShape(640, 480);
+
+Pipeline::Pipeline(const Config& configIn, FaceRecognizer* recognizerIn, const std::filesystem::path& debugOutputPathIn,
+	Journal* journalIn, DetectionCache* detectionCacheIn):
+	config(configIn), recognizer(recognizerIn), debugOutputPath(debugOutputPathIn), journal(journalIn),
+	configFingerprint(Journal::configFingerprint(configIn)), detectionCache(detectionCacheIn),
+	fileWriter(configIn.outputDir, configIn.durable ? configIn.syncInterval : 0), memoryBudget(configIn.maxInflightMem),
+	inputQueue(config.decodeThreads), detectQueue(std::max(config.queueDepth, config.batchSize)), cropQueue(config.queueDepth), encodeQueue(config.queueDepth)
+{
+	for(const cv::Size& size : config.outputSizes())
+		analysisLongSide = std::max(analysisLongSide, std::max(size.width, size.height)*2);
+
+	if(config.outputTarSize > 0)
+	{
+		for(const cv::Size& size : config.outputSizes())
+			tarWriters.push_back(std::make_unique<TarShardWriter>(outputDirectory(config, size, config.outputDir), "shard", config.outputTarSize));
+	}
+	else if(config.packedOutput)
+	{
+		for(const cv::Size& size : config.outputSizes())
+			packedWriters.push_back(std::make_unique<PackedWriter>(config.outputDir/("packed-" + sizeDirName(size)), size));
+	}
+
+	if(config.dedupRadius >= 0)
+		deduplicator = std::make_unique<Deduplicator>(config.dedupRadius);
+
+	if(detectionCache)
+	{
+		// face matches are cached too, so the referance image and threshold are part of the model
+		detectionModelHash = Yolo::modelHash(config.modelPath, config.classesPath);
+		if(recognizer)
+		{
+			std::vector<unsigned char> referance;
+			readFileData(config.focusPersonImage, referance);
+			detectionModelHash = hashBytes(referance.data(), referance.size(), detectionModelHash);
+			detectionModelHash = hashBytes(&config.threshold, sizeof(config.threshold), detectionModelHash);
+		}
+	}
+
+	stats[STAGE_DECODE].resize(config.decodeThreads);
+	stats[STAGE_DETECT].resize(config.detectThreads);
+	stats[STAGE_CROP].resize(config.cropThreads);
+	stats[STAGE_ENCODE].resize(config.encodeThreads);
+
+	for(size_t i = 0; i < config.decodeThreads; ++i)
+		detectQueue.addProducer();
+	for(size_t i = 0; i < config.detectThreads; ++i)
+		cropQueue.addProducer();
+	for(size_t i = 0; i < config.cropThreads; ++i)
+		encodeQueue.addProducer();
+
+	startTime = std::chrono::steady_clock::now();
+
+	for(size_t i = 0; i < config.decodeThreads; ++i)
+		threads.push_back(std::thread(&Pipeline::decodeWorker, this, i));
+	for(size_t i = 0; i < config.detectThreads; ++i)
+		threads.push_back(std::thread(&Pipeline::detectWorker, this, i));
+	for(size_t i = 0; i < config.cropThreads; ++i)
+		threads.push_back(std::thread(&Pipeline::cropWorker, this, i));
+	for(size_t i = 0; i < config.encodeThreads; ++i)
+		threads.push_back(std::thread(&Pipeline::encodeWorker, this, i));
+}
+
+Pipeline::~Pipeline()
+{
+	finish();
+}
+
+void Pipeline::push(const std::filesystem::path& path)
+{
+	// queued paths are cheap compared to in memory images, so the crawler may run further ahead,
+	// but a large tree must not end up in the queue as a whole
+	inputQueue.waitBelow(std::max<size_t>(1024, (config.readAhead+config.queueDepth)*config.decodeThreads));
+	std::unique_ptr<ImageJob> job = std::make_unique<ImageJob>();
+	job->path = path;
+	inputQueue.push(std::move(job));
+}
+
+void Pipeline::push(const std::filesystem::path& path, std::vector<unsigned char>&& data, int64_t mtime,
+	std::shared_ptr<const ImageOptions> options)
+{
+	// in memory images would otherwise pile up if they are produced faster than they can be decoded
+	inputQueue.waitBelow(config.queueDepth*config.decodeThreads);
+	std::unique_ptr<ImageJob> job = std::make_unique<ImageJob>();
+	job->path = path;
+	job->inMemory = true;
+	job->journalEntry.input = path;
+	job->journalEntry.size = data.size();
+	job->journalEntry.mtime = mtime;
+	job->data = std::move(data);
+	job->options = std::move(options);
+	inputQueue.push(std::move(job));
+}
+
+void Pipeline::finish()
+{
+	if(finished)
+		return;
+	inputQueue.close();
+	for(std::thread& thread : threads)
+		thread.join();
+	// closes the last shards and writes the packed file indices
+	tarWriters.clear();
+	packedWriters.clear();
+	fileWriter.flush();
+	for(std::function<void()>& action : packedCommits)
+		action();
+	packedCommits.clear();
+	finished = true;
+}
+
+bool Pipeline::isDone(ImageJob& job)
+{
+	if(!journal || config.resume == Config::RESUME_OFF)
+		return false;
+	return journal->isDone(job.journalEntry, config.resume == Config::RESUME_CONFIG);
+}
+
+void Pipeline::releaseMemory(ImageJob& job)
+{
+	memoryBudget.release(job.reservedBytes);
+	job.reservedBytes = 0;
+}
+
+size_t Pipeline::estimateMemory(const ImageJob& job, const unsigned char* data, size_t size, size_t& transient) const
+{
+	cv::Size imageSize;
+	bool isJpeg = false;
+	if(!readImageSize(data, size, imageSize, isJpeg))
+	{
+		// unknown format, assume a compression ratio of about 10
+		int side = std::sqrt(size*10/3);
+		imageSize = cv::Size(side, side);
+	}
+
+	int minLongSide = config.proxySize > 0 ? config.proxySize : analysisLongSideOf(job);
+	int scale = decodeScale(imageSize, isJpeg, minLongSide);
+	double decodedWidth = static_cast<double>(imageSize.width)/scale;
+	double decodedHeight = static_cast<double>(imageSize.height)/scale;
+	transient = decodedWidth*decodedHeight*3;
+	if(job.inMemory)
+		transient += size;
+
+	double reduce = std::min(1.0, minLongSide/std::max(decodedWidth, decodedHeight));
+	double analysisBytes = decodedWidth*decodedHeight*3*reduce*reduce;
+	// seam carving holds transposed and stretched copies of the analysis image
+	double resident = analysisBytes*(seamCarving(job) ? 4 : 1);
+
+	int largestOutput = 0;
+	for(const cv::Size& outputSize : outputSizes(job))
+	{
+		// the output image and its encoded copy
+		resident += static_cast<double>(outputSize.width)*outputSize.height*3*2;
+		largestOutput = std::max(largestOutput, std::max(outputSize.width, outputSize.height));
+	}
+
+	// proxy mode keeps the file and decodes the source again to crop from it
+	if(config.proxySize > 0)
+	{
+		int cropScale = decodeScale(imageSize, isJpeg, largestOutput);
+		resident += size + static_cast<double>(imageSize.width)*imageSize.height*3/(cropScale*cropScale);
+	}
+
+	return transient + resident;
+}
+
+void Pipeline::recordResult(ImageJob& job, bool ok, const std::filesystem::path& output)
+{
+	releaseMemory(job);
+	if(journal)
+	{
+		job.journalEntry.status = ok ? Journal::STATUS_OK : Journal::STATUS_FAILED;
+		job.journalEntry.output = output;
+		journal->append(job.journalEntry);
+	}
+	if(ok && job.dedupOriginal)
+		deduplicator->add(job.path, job.contentHash, job.encodedSize, job.perceptualHash);
+	if(completionCallback)
+		completionCallback(job.path, ok);
+}
+
+void Pipeline::recordSkipped(ImageJob& job)
+{
+	Log(Log::DEBUG)<<job.path<<" is already done according to the journal, skipping";
+	releaseMemory(job);
+	++skipped;
+	if(completionCallback)
+		completionCallback(job.path, true);
+}
+
+void Pipeline::recordDuplicate(ImageJob& job, const std::filesystem::path& original, bool exact)
+{
+	Log(Log::INFO)<<job.path<<" is "<<(exact ? "a copy" : "similar")<<" to "<<original<<", skipping";
+	if(exact)
+		++exactDuplicates;
+	else
+		++similarDuplicates;
+	// recorded as done, so that on resume the duplicate is skipped even though its original is not seen again
+	recordResult(job, true);
+}
+
+bool Pipeline::isSimilar(ImageJob& job, const cv::Mat& image)
+{
+	std::filesystem::path original;
+	job.perceptualHash = Deduplicator::perceptualHash(image);
+	if(!deduplicator->findSimilar(job.perceptualHash, original))
+	{
+		job.dedupOriginal = true;
+		return false;
+	}
+	recordDuplicate(job, original, false);
+	return true;
+}
+
+void Pipeline::setCompletionCallback(CompletionCallback callback)
+{
+	completionCallback = callback;
+}
+
+void Pipeline::setResultCallback(ResultCallback callback)
+{
+	resultCallback = callback;
+}
+
+void Pipeline::prefetchQueued(size_t worker, bool wholeWindow)
+{
+	// normally only the file that just moved into the read ahead window needs a hint
+	for(size_t i = wholeWindow ? 0 : config.readAhead-1; i < config.readAhead; ++i)
+	{
+		std::filesystem::path path;
+		bool queued = inputQueue.visit(worker, i, [&path](const std::unique_ptr<ImageJob>& job)
+		{
+			if(!job->inMemory)
+				path = job->path;
+		});
+		if(!queued)
+			break;
+		if(!path.empty())
+			prefetchFile(path);
+	}
+}
+
+void Pipeline::decodeWorker(size_t id)
+{
+	WorkerStats& stat = stats[STAGE_DECODE][id];
+	PoolAllocator::setThreadLabel(STAGE_DECODE+1);
+	std::unique_ptr<ImageJob> job;
+	bool stolen;
+	bool primed = false;
+	while(inputQueue.pop(id, job, &stolen))
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		const std::filesystem::path& path = job->path;
+		// archive members have no file to stat and are identified by their content in the journal instead
+		bool hashContent = config.journalHash || job->inMemory;
+
+		if(journal)
+		{
+			if(!job->inMemory)
+				Journal::statInput(path, job->journalEntry);
+			job->journalEntry.configFingerprint = configFingerprint;
+			if(!hashContent && isDone(*job))
+			{
+				recordSkipped(*job);
+				stat.busy += std::chrono::steady_clock::now() - start;
+				continue;
+			}
+		}
+
+		if(config.readAhead > 0)
+		{
+			prefetchQueued(id, !primed || stolen);
+			primed = true;
+		}
+
+		std::vector<unsigned char> data;
+		std::unique_ptr<MappedFile> mapped;
+		const unsigned char* bytes = nullptr;
+		size_t byteCount = 0;
+		if(job->inMemory)
+		{
+			data = std::move(job->data);
+			bytes = data.data();
+			byteCount = data.size();
+		}
+		else
+		{
+			mapped = std::make_unique<MappedFile>(path, !config.keepPageCache);
+			bytes = mapped->data();
+			byteCount = mapped->size();
+		}
+		bool read = byteCount > 0;
+
+		if(read && (detectionCache || deduplicator || (journal && hashContent)))
+			job->contentHash = hashBytes(bytes, byteCount);
+
+		if(read && journal && hashContent)
+		{
+			job->journalEntry.contentHash = job->contentHash;
+			if(isDone(*job))
+			{
+				recordSkipped(*job);
+				stat.busy += std::chrono::steady_clock::now() - start;
+				continue;
+			}
+		}
+
+		// duplicates are found before the full decode where possible, for jpegs from a cheap 1/8 scale decode
+		bool perceptualHashed = false;
+		if(read && deduplicator)
+		{
+			std::filesystem::path original;
+			job->encodedSize = byteCount;
+			bool duplicate = deduplicator->findExact(job->contentHash, byteCount, original);
+			if(duplicate)
+			{
+				recordDuplicate(*job, original, true);
+			}
+			else
+			{
+				cv::Mat thumbnail = decodeThumbnail(bytes, byteCount);
+				perceptualHashed = !thumbnail.empty();
+				duplicate = perceptualHashed && isSimilar(*job, thumbnail);
+			}
+			if(duplicate)
+			{
+				stat.busy += std::chrono::steady_clock::now() - start;
+				continue;
+			}
+		}
+
+		size_t transientBytes = 0;
+		if(read && memoryBudget.isLimited())
+		{
+			size_t estimate = estimateMemory(*job, bytes, byteCount, transientBytes);
+			job->reservedBytes = memoryBudget.acquire(estimate);
+			transientBytes = std::min(transientBytes, job->reservedBytes);
+		}
+
+		if(read)
+		{
+			readImageSize(bytes, byteCount, job->sourceSize, job->isJpeg);
+			job->image = decodeImage(bytes, byteCount, config.proxySize > 0 ? config.proxySize : analysisLongSideOf(*job));
+			// formats without a known header are decoded at full size
+			if(job->sourceSize.width <= 0)
+				job->sourceSize = job->image.size();
+		}
+
+		if(!job->image.data)
+		{
+			Log(Log::WARN)<<"could not load image "<<path<<" skipping";
+			recordResult(*job, false);
+			stat.busy += std::chrono::steady_clock::now() - start;
+			continue;
+		}
+
+		if(deduplicator && !perceptualHashed && isSimilar(*job, job->image))
+		{
+			stat.busy += std::chrono::steady_clock::now() - start;
+			continue;
+		}
+
+		if(config.proxySize > 0)
+		{
+			reduceLongSide(job->image, config.proxySize);
+			if(mapped)
+				data.assign(bytes, bytes+byteCount);
+			job->data = std::move(data);
+		}
+		else
+		{
+			reduceLongSide(job->image, analysisLongSideOf(*job));
+		}
+		memoryBudget.release(transientBytes);
+		job->reservedBytes -= transientBytes;
+
+		job->stageTimes[STAGE_DECODE] = std::chrono::steady_clock::now() - start;
+		stat.busy += job->stageTimes[STAGE_DECODE];
+		++stat.processed;
+		if(stolen)
+			++stat.stolen;
+		detectQueue.push(std::move(job));
+	}
+	detectQueue.removeProducer();
+}
+
+void Pipeline::applyFaceMatches(ImageJob& job)
+{
+	for(size_t i = 0; i < job.detections.size(); ++i)
+	{
+		Yolo::Detection& detection = job.detections[i];
+		bool hasmatch = i < job.faceMatches.size() && job.faceMatches[i].person >= 0;
+		if(hasmatch)
+			detection.priority += 10;
+		Log(Log::DEBUG)<<detection.class_id<<": "<<detection.className<<" at "<<detection.box<<" with prio "<<detection.priority<<(hasmatch ? " has match" : "");
+	}
+}
+
+void Pipeline::matchPersons(ImageJob& job)
+{
+	job.faceMatches.assign(job.detections.size(), FaceRecognizer::Detection{-1, 0, cv::Rect()});
+	for(size_t i = 0; i < job.detections.size(); ++i)
+	{
+		const Yolo::Detection& detection = job.detections[i];
+		if(recognizer && detection.className == "person")
+		{
+			cv::Mat person = job.image(detection.box);
+			recognizerMutex.lock();
+			job.faceMatches[i] = recognizer->isMatch(person);
+			recognizerMutex.unlock();
+		}
+	}
+	applyFaceMatches(job);
+}
+
+DetectionCache::Key Pipeline::cacheKey(const ImageJob& job) const
+{
+	DetectionCache::Key key;
+	key.contentHash = job.contentHash;
+	key.modelHash = detectionModelHash;
+	key.width = modelInputShape.width;
+	key.height = modelInputShape.height;
+	return key;
+}
+
+bool Pipeline::loadCachedDetections(ImageJob& job, const Yolo& yolo)
+{
+	std::vector<DetectionCache::Entry> entries;
+	if(!detectionCache || !detectionCache->lookup(cacheKey(job), entries))
+		return false;
+
+	job.detections.clear();
+	job.faceMatches.clear();
+	for(const DetectionCache::Entry& entry : entries)
+	{
+		cv::Rect box(std::lround(entry.box.x*job.image.cols), std::lround(entry.box.y*job.image.rows),
+			std::lround(entry.box.width*job.image.cols), std::lround(entry.box.height*job.image.rows));
+		box &= cv::Rect(0, 0, job.image.cols, job.image.rows);
+		job.detections.push_back(yolo.makeDetection(entry.classId, entry.confidence, box));
+		job.faceMatches.push_back({entry.person, entry.personConfidence, cv::Rect()});
+	}
+	Log(Log::DEBUG)<<"Got "<<job.detections.size()<<" cached detections for "<<job.path;
+	applyFaceMatches(job);
+	return true;
+}
+
+void Pipeline::storeDetections(const ImageJob& job)
+{
+	if(!detectionCache)
+		return;
+
+	std::vector<DetectionCache::Entry> entries;
+	for(size_t i = 0; i < job.detections.size(); ++i)
+	{
+		const Yolo::Detection& detection = job.detections[i];
+		DetectionCache::Entry entry;
+		entry.classId = detection.class_id;
+		entry.confidence = detection.confidence;
+		entry.box = cv::Rect2f(static_cast<float>(detection.box.x)/job.image.cols, static_cast<float>(detection.box.y)/job.image.rows,
+			static_cast<float>(detection.box.width)/job.image.cols, static_cast<float>(detection.box.height)/job.image.rows);
+		if(i < job.faceMatches.size())
+		{
+			entry.person = job.faceMatches[i].person;
+			entry.personConfidence = job.faceMatches[i].confidence;
+		}
+		entries.push_back(entry);
+	}
+	detectionCache->store(cacheKey(job), entries);
+}
+
+void Pipeline::detectWorker(size_t id)
+{
+	WorkerStats& stat = stats[STAGE_DETECT][id];
+	PoolAllocator::setThreadLabel(STAGE_DETECT+1);
+	std::unique_ptr<Yolo> yoloPtr;
+	std::unique_ptr<ImageJob> job;
+	try
+	{
+		yoloPtr = std::make_unique<Yolo>(config.modelPath, modelInputShape, config.classesPath, false);
+	}
+	catch(const std::exception& ex)
+	{
+		Log(Log::ERROR)<<"could not load the detection model: "<<ex.what();
+		// the images still have to be completed, otherwise finish() would never return
+		while(detectQueue.pop(job))
+			recordResult(*job, false);
+		cropQueue.removeProducer();
+		return;
+	}
+	Yolo& yolo = *yoloPtr;
+	InteligentRoi intRoi(yolo);
+	size_t batchSize = config.batchSize;
+
+	std::vector<std::unique_ptr<ImageJob>> batch;
+	while(detectQueue.pop(job))
+	{
+		batch.clear();
+		batch.push_back(std::move(job));
+		while(batch.size() < batchSize && detectQueue.tryPop(job))
+			batch.push_back(std::move(job));
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		std::vector<ImageJob*> uncached;
+		std::vector<cv::Mat> images;
+		for(const std::unique_ptr<ImageJob>& batchJob : batch)
+		{
+			if(!loadCachedDetections(*batchJob, yolo))
+			{
+				uncached.push_back(batchJob.get());
+				images.push_back(batchJob->image);
+			}
+		}
+
+		std::vector<std::vector<Yolo::Detection>> detections;
+		if(images.size() > 1)
+		{
+			try
+			{
+				detections = yolo.runInference(images);
+			}
+			catch(const cv::Exception& ex)
+			{
+				Log(Log::WARN)<<"Batched inference failed, the model probably has a fixed batch size, falling back to a batch size of 1: "<<ex.what();
+				batchSize = 1;
+			}
+		}
+		if(detections.empty())
+		{
+			for(const cv::Mat& image : images)
+				detections.push_back(yolo.runInference(image));
+		}
+
+		for(size_t i = 0; i < uncached.size(); ++i)
+		{
+			uncached[i]->detections = std::move(detections[i]);
+			Log(Log::DEBUG)<<"Got "<<uncached[i]->detections.size()<<" detections for "<<uncached[i]->path;
+			matchPersons(*uncached[i]);
+			storeDetections(*uncached[i]);
+		}
+
+		for(const std::unique_ptr<ImageJob>& batchJob : batch)
+			computeCrops(*batchJob, intRoi);
+
+		// every image of a batch waits for the whole batch
+		std::chrono::duration<double> busy = std::chrono::steady_clock::now() - start;
+		for(const std::unique_ptr<ImageJob>& batchJob : batch)
+			batchJob->stageTimes[STAGE_DETECT] = busy;
+		stat.busy += busy;
+		stat.processed += batch.size();
+
+		for(std::unique_ptr<ImageJob>& batchJob : batch)
+			cropQueue.push(std::move(batchJob));
+	}
+	cropQueue.removeProducer();
+}
+
+std::string Pipeline::sizeDirName(const cv::Size& size)
+{
+	return std::to_string(size.width) + 'x' + std::to_string(size.height);
+}
+
+std::filesystem::path Pipeline::outputDirectory(const Config& config, const cv::Size& size, const std::filesystem::path& base)
+{
+	if(config.outputSizes().size() > 1)
+		return base/sizeDirName(size);
+	return base;
+}
+
+void Pipeline::saveDebugImage(const ImageJob& job, size_t target, const cv::Mat& image, const std::vector<Yolo::Detection>& detections)
+{
+	cv::Mat debugImage = image.clone();
+	drawDebugInfo(debugImage, job.outputs[target].crop, detections);
+	std::filesystem::path path = outputDirectory(config, job.outputs[target].size, debugOutputPath)/job.path.filename();
+	bool ret = cv::imwrite(path, debugImage);
+	if(!ret)
+		Log(Log::WARN)<<"could not save debug image to "<<path<<" skipping";
+}
+
+void Pipeline::computeCrops(ImageJob& job, InteligentRoi& intRoi)
+{
+	job.outputs.clear();
+	if(!config.buckets.empty() && !job.options)
+	{
+		// in proxy mode the output is resampled from the source, otherwise from the analysis image
+		double sourceScale = 1.0;
+		if(!job.data.empty() && job.sourceSize.width > 0)
+			sourceScale = static_cast<double>(std::max(job.sourceSize.width, job.sourceSize.height))/std::max(job.image.cols, job.image.rows);
+
+		ImageOutput output;
+		size_t bucket = intRoi.getBestBucket(output.crop, output.incompleate, job.detections, job.image.size(), config.buckets, sourceScale);
+		output.size = config.buckets[bucket];
+		Log(Log::DEBUG)<<"Choose bucket "<<output.size<<" for "<<job.path;
+		job.outputs.push_back(output);
+		return;
+	}
+
+	for(const cv::Size& size : outputSizes(job))
+	{
+		ImageOutput output;
+		output.size = size;
+		output.incompleate = intRoi.getCropRectangle(output.crop, job.detections, job.image.size(), size.aspectRatio());
+		job.outputs.push_back(output);
+	}
+}
+
+void Pipeline::loadAnalysisResolution(ImageJob& job)
+{
+	int longSide = analysisLongSideOf(job);
+	cv::Mat image = decodeImage(job.data.data(), job.data.size(), longSide);
+	if(!image.data)
+		return;
+	reduceLongSide(image, longSide);
+
+	double factor = static_cast<double>(std::max(image.cols, image.rows))/std::max(job.image.cols, job.image.rows);
+	for(Yolo::Detection& detection : job.detections)
+	{
+		scaleRect(detection.box, factor);
+		detection.box &= cv::Rect(0, 0, image.cols, image.rows);
+	}
+	for(ImageOutput& output : job.outputs)
+	{
+		scaleRect(output.crop, factor);
+		output.crop &= cv::Rect(0, 0, image.cols, image.rows);
+	}
+	job.image = image;
+}
+
+bool Pipeline::cropFromSource(ImageJob& job)
+{
+	const cv::Mat& proxy = job.image;
+	int proxyLongSide = std::max(proxy.cols, proxy.rows);
+	int sourceLongSide = std::max(job.sourceSize.width, job.sourceSize.height);
+	if(sourceLongSide <= 0)
+		sourceLongSide = proxyLongSide;
+	double sourceFactor = static_cast<double>(sourceLongSide)/proxyLongSide;
+
+	// pick the smallest dct scale at which every croped region still covers its target size
+	int scale = job.isJpeg ? 8 : 1;
+	std::vector<cv::Rect> crops;
+	for(size_t i = 0; i < job.outputs.size(); ++i)
+	{
+		const ImageOutput& output = job.outputs[i];
+		cv::Rect crop = output.crop;
+		if(proxy.size().aspectRatio() == output.size.aspectRatio())
+			crop = cv::Rect(0, 0, proxy.cols, proxy.rows);
+		else if(config.debug)
+			saveDebugImage(job, i, proxy, job.detections);
+
+		while(scale > 1 && (crop.width*sourceFactor/scale < output.size.width || crop.height*sourceFactor/scale < output.size.height))
+			scale /= 2;
+		crops.push_back(crop);
+	}
+
+	cv::Mat source = decodeImageScaled(job.data.data(), job.data.size(), scale);
+	if(!source.data)
+	{
+		Log(Log::WARN)<<"could not decode "<<job.path<<" a second time";
+		return false;
+	}
+
+	double factor = static_cast<double>(std::max(source.cols, source.rows))/proxyLongSide;
+	for(size_t i = 0; i < job.outputs.size(); ++i)
+	{
+		ImageOutput& output = job.outputs[i];
+		cv::Rect crop = crops[i];
+		output.crop = crop;
+		output.cropBase = proxy.size();
+		scaleRect(crop, factor);
+		crop &= cv::Rect(0, 0, source.cols, source.rows);
+		Log(Log::DEBUG)<<"Croping "<<crop<<" from "<<job.path<<" decoded at "<<source.size()<<" for "<<output.size;
+
+		cv::Mat croppedImage = source(crop);
+		int interpolation = croppedImage.cols > output.size.width ? cv::INTER_AREA : cv::INTER_CUBIC;
+		cv::resize(croppedImage, output.image, output.size, 0, 0, interpolation);
+	}
+	return true;
+}
+
+void Pipeline::carveAndCrop(ImageJob& job, size_t target, std::unique_ptr<Yolo>& yolo, std::unique_ptr<InteligentRoi>& intRoi)
+{
+	ImageOutput& output = job.outputs[target];
+	double targetAspectRatio = output.size.aspectRatio();
+	cv::Mat image = job.image;
+	std::vector<Yolo::Detection> carvedDetections;
+	const std::vector<Yolo::Detection>* detections = &job.detections;
+
+	if(seamCarving(job) && output.incompleate)
+	{
+		// the analysis image is shared between all targets
+		image = job.image.clone();
+		bool carved = seamCarveResize(image, job.detections, targetAspectRatio);
+		output.seamCarved = carved;
+		if(carved && image.size().aspectRatio() != targetAspectRatio)
+		{
+			if(yolo || loadRedetectionModel(yolo, intRoi))
+			{
+				carvedDetections = yolo->runInference(image);
+				detections = &carvedDetections;
+				output.incompleate = intRoi->getCropRectangle(output.crop, carvedDetections, image.size(), targetAspectRatio);
+			}
+			else
+			{
+				// without detections on the carved image the crop computed on the original one is used
+				image = job.image;
+				output.seamCarved = false;
+			}
+		}
+	}
+
+	cv::Mat croppedImage;
+	output.cropBase = image.size();
+	if(image.size().aspectRatio() == targetAspectRatio)
+	{
+		croppedImage = image;
+		output.crop = cv::Rect(0, 0, image.cols, image.rows);
+	}
+	else
+	{
+		if(config.debug)
+			saveDebugImage(job, target, image, *detections);
+		croppedImage = image(output.crop);
+	}
+
+	cv::resize(croppedImage, output.image, output.size, 0, 0, cv::INTER_CUBIC);
+}
+
+bool Pipeline::checkModels(const Config& config, std::string& error)
+{
+	try
+	{
+		Yolo yolo(config.modelPath, modelInputShape, config.classesPath, false);
+	}
+	catch(const std::exception& ex)
+	{
+		error = std::string("could not load the detection model: ") + ex.what();
+		return false;
+	}
+	return true;
+}
+
+bool Pipeline::loadRedetectionModel(std::unique_ptr<Yolo>& yolo, std::unique_ptr<InteligentRoi>& intRoi)
+{
+	try
+	{
+		yolo = std::make_unique<Yolo>(config.modelPath, modelInputShape, config.classesPath, false);
+		intRoi = std::make_unique<InteligentRoi>(*yolo);
+		return true;
+	}
+	catch(const std::exception& ex)
+	{
+		Log(Log::ERROR)<<"could not load the detection model for seam carved images: "<<ex.what();
+		yolo.reset();
+		intRoi.reset();
+		return false;
+	}
+}
+
+void Pipeline::cropWorker(size_t id)
+{
+	WorkerStats& stat = stats[STAGE_CROP][id];
+	PoolAllocator::setThreadLabel(STAGE_CROP+1);
+
+	// only needed to re-detect after seam carving, so created on first use
+	std::unique_ptr<Yolo> yolo;
+	std::unique_ptr<InteligentRoi> intRoi;
+	if(config.preloadModels)
+		loadRedetectionModel(yolo, intRoi);
+
+	std::unique_ptr<ImageJob> job;
+	while(cropQueue.pop(job))
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		bool fromSource = !job->data.empty();
+		// seam carving works on the whole image, so for these images we fall back to processing at 2x the target size
+		if(fromSource && seamCarving(*job))
+		{
+			for(const ImageOutput& output : job->outputs)
+			{
+				if(output.incompleate)
+				{
+					loadAnalysisResolution(*job);
+					fromSource = false;
+					break;
+				}
+			}
+		}
+
+		bool ret = true;
+		if(fromSource)
+		{
+			ret = cropFromSource(*job);
+		}
+		else
+		{
+			for(size_t i = 0; i < job->outputs.size(); ++i)
+				carveAndCrop(*job, i, yolo, intRoi);
+		}
+
+		job->analysisSize = job->image.size();
+		job->image.release();
+		job->data = std::vector<unsigned char>();
+
+		job->stageTimes[STAGE_CROP] = std::chrono::steady_clock::now() - start;
+		stat.busy += job->stageTimes[STAGE_CROP];
+		if(!ret)
+		{
+			recordResult(*job, false);
+			continue;
+		}
+		++stat.processed;
+		encodeQueue.push(std::move(job));
+	}
+	encodeQueue.removeProducer();
+}
+
+const std::vector<cv::Size>& Pipeline::outputSizes(const ImageJob& job) const
+{
+	return job.options ? job.options->targetSizes : config.outputSizes();
+}
+
+bool Pipeline::seamCarving(const ImageJob& job) const
+{
+	return job.options ? job.options->seamCarving : config.seamCarving;
+}
+
+std::string Pipeline::outputFormat(const ImageJob& job) const
+{
+	if(job.options && !job.options->outputFormat.empty())
+		return job.options->outputFormat;
+	return config.outputFormat;
+}
+
+int Pipeline::analysisLongSideOf(const ImageJob& job) const
+{
+	if(!job.options)
+		return analysisLongSide;
+	int longSide = 0;
+	for(const cv::Size& size : job.options->targetSizes)
+		longSide = std::max(longSide, std::max(size.width, size.height)*2);
+	return longSide;
+}
+
+size_t Pipeline::outputIndex(const cv::Size& size) const
+{
+	const std::vector<cv::Size>& sizes = config.outputSizes();
+	size_t index = std::find(sizes.begin(), sizes.end(), size) - sizes.begin();
+	return std::min(index, sizes.size()-1);
+}
+
+std::vector<int> Pipeline::encodeParams(std::string extension) const
+{
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	std::vector<int> params;
+	if((extension == ".jpg" || extension == ".jpeg") && config.jpegQuality >= 0)
+		params = {cv::IMWRITE_JPEG_QUALITY, config.jpegQuality};
+	else if(extension == ".png" && config.pngCompression >= 0)
+		params = {cv::IMWRITE_PNG_COMPRESSION, config.pngCompression};
+	else if(extension == ".webp" && config.webpQuality >= 0)
+		params = {cv::IMWRITE_WEBP_QUALITY, config.webpQuality};
+	return params;
+}
+
+void Pipeline::encodeWorker(size_t id)
+{
+	WorkerStats& stat = stats[STAGE_ENCODE][id];
+	PoolAllocator::setThreadLabel(STAGE_ENCODE+1);
+	std::unique_ptr<ImageJob> job;
+	while(encodeQueue.pop(job))
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool ok = true;
+		std::filesystem::path firstOutput;
+		for(size_t i = 0; i < job->outputs.size(); ++i)
+		{
+			ImageOutput& output = job->outputs[i];
+			std::filesystem::path outputPath;
+			bool ret;
+			if(config.inMemoryOutput)
+			{
+				std::string extension = outputFormat(*job);
+				if(extension.empty())
+					extension = job->path.extension().string();
+				ret = cv::imencode(extension, output.image, output.encoded, encodeParams(extension));
+			}
+			else if(!packedWriters.empty())
+			{
+				PackedWriter& writer = *packedWriters[outputIndex(output.size)];
+				int64_t record = writer.append(output.image, job->path);
+				ret = record >= 0;
+				outputPath = writer.getPath().string() + ':' + std::to_string(record);
+			}
+			else
+			{
+				std::vector<unsigned char> buffer;
+				std::filesystem::path name = job->path.filename();
+				std::string format = outputFormat(*job);
+				if(!format.empty())
+					name.replace_extension(format);
+				std::string extension = name.extension().string();
+				ret = cv::imencode(extension, output.image, buffer, encodeParams(extension));
+				if(ret && !tarWriters.empty())
+				{
+					std::filesystem::path archive = tarWriters[outputIndex(output.size)]->write(name.string(), buffer);
+					ret = !archive.empty();
+					outputPath = archive/name;
+				}
+				else if(ret)
+				{
+					outputPath = outputDirectory(config, output.size, config.outputDir)/name;
+					ret = fileWriter.write(outputPath, buffer);
+				}
+			}
+
+			if(!ret)
+			{
+				Log(Log::WARN)<<"could not save "<<job->path<<" to "<<outputPath<<" skipping";
+				ok = false;
+			}
+			if(i == 0)
+				firstOutput = outputPath;
+		}
+		job->stageTimes[STAGE_ENCODE] = std::chrono::steady_clock::now() - start;
+		if(resultCallback)
+			resultCallback(*job, ok);
+		// the journal entry may only be written once the output is durable
+		std::shared_ptr<ImageJob> done(std::move(job));
+		done->outputs.clear();
+		releaseMemory(*done);
+		std::function<void()> action = [this, done, ok, firstOutput](){recordResult(*done, ok, firstOutput);};
+		if(!packedWriters.empty())
+		{
+			std::lock_guard<std::mutex> lock(packedCommitMutex);
+			packedCommits.push_back(std::move(action));
+		}
+		else
+		{
+			fileWriter.commit(std::move(action));
+		}
+		stat.busy += std::chrono::steady_clock::now() - start;
+		++stat.processed;
+	}
+}
+
+const std::vector<WorkerStats>& Pipeline::getStats(Stage stage) const
+{
+	return stats[stage];
+}
+
+const char* Pipeline::stageName(Stage stage)
+{
+	switch(stage)
+	{
+		case STAGE_DECODE:
+			return "decode";
+		case STAGE_DETECT:
+			return "detect";
+		case STAGE_CROP:
+			return "crop";
+		case STAGE_ENCODE:
+			return "encode";
+		default:
+			return "unknown";
+	}
+}
+
+void Pipeline::logStats() const
+{
+	std::chrono::duration<double> wallTime = std::chrono::steady_clock::now() - startTime;
+	size_t processed = 0;
+	for(const WorkerStats& stat : stats[STAGE_ENCODE])
+		processed += stat.processed;
+	Log(Log::INFO)<<"Processed "<<processed<<" images in "<<wallTime.count()<<"s";
+	if(skipped > 0)
+		Log(Log::INFO)<<"Skipped "<<skipped<<" images that where already done according to the journal";
+	if(deduplicator)
+		Log(Log::INFO)<<"Skipped "<<exactDuplicates<<" exact copies and "<<similarDuplicates<<" similar images as duplicates";
+	if(memoryBudget.isLimited())
+		Log(Log::INFO)<<"Peak estimated memory in flight "<<memoryBudget.getPeak()/(1024*1024)<<"MiB, images waited for memory "<<memoryBudget.getWaits()<<" times";
+	if(config.durable)
+		Log(Log::INFO)<<"Synced outputs to disk "<<fileWriter.syncCount()<<" times";
+	for(size_t stage = 0; stage < STAGE_COUNT; ++stage)
+	{
+		for(size_t i = 0; i < stats[stage].size(); ++i)
+		{
+			const WorkerStats& stat = stats[stage][i];
+			Log(Log::INFO)<<stageName(static_cast<Stage>(stage))<<" worker "<<i<<": "<<stat.processed<<" images, "
+				<<stat.stolen<<" stolen, busy "<<stat.busy.count()<<"s ("<<stat.busy.count()/wallTime.count()*100<<"% utilization)";
+		}
+	}
+}
@@ -0,0 +1,199 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <array>
+#include <chrono>
+#include <opencv2/core.hpp>
+
+#include "config.h"
+#include "yolo.h"
+#include "facerecognizer.h"
+#include "intelligentroi.h"
+#include "workqueue.h"
+#include "journal.h"
+#include "detectioncache.h"
+#include "tar.h"
+#include "packedwriter.h"
+#include "filewriter.h"
+#include "memorybudget.h"
+#include "dedup.h"
+
+struct ImageOutput
+{
+	cv::Size size;
+	cv::Rect crop;
+	// size of the image crop is a rectangle of, this is the seam carved image for carved outputs
+	cv::Size cropBase;
+	bool incompleate = false;
+	bool seamCarved = false;
+	cv::Mat image;
+	// the encoded image when the outputs are kept in memory
+	std::vector<unsigned char> encoded;
+};
+
+struct ImageJob
+{
+	std::filesystem::path path;
+	// the encoded file, set for in memory inputs such as archive members and kept in proxy mode where the output is croped from the source
+	std::vector<unsigned char> data;
+	bool inMemory = false;
+	// overrides the output sizes, seam carving and output format of the config for this image
+	std::shared_ptr<const ImageOptions> options;
+	cv::Size sourceSize;
+	bool isJpeg = false;
+	cv::Mat image;
+	uint64_t contentHash = 0;
+	// set once the image is known not to be a duplicate, it is added to the deduplicator when its output is committed
+	bool dedupOriginal = false;
+	size_t encodedSize = 0;
+	uint64_t perceptualHash = 0;
+	std::vector<Yolo::Detection> detections;
+	// size of the image the detections are in, kept after image is released
+	cv::Size analysisSize;
+	std::vector<FaceRecognizer::Detection> faceMatches;
+	std::vector<ImageOutput> outputs;
+	Journal::Entry journalEntry;
+	// bytes of the memory budget held by this image
+	size_t reservedBytes = 0;
+	// time spent on this image in each stage, indexed by Pipeline::Stage
+	std::array<std::chrono::duration<double>, 4> stageTimes = {};
+};
+
+// Processes images in four stages: decode -> detect -> crop/carve -> encode.
+// Each stage runs on its own threads and the stages are joined by bounded queues
+// so that loading and saving images overlaps with inference.
+class Pipeline
+{
+public:
+	typedef std::function<void(const std::filesystem::path& path, bool ok)> CompletionCallback;
+	typedef std::function<void(const ImageJob& job, bool ok)> ResultCallback;
+
+	enum Stage
+	{
+		STAGE_DECODE = 0,
+		STAGE_DETECT,
+		STAGE_CROP,
+		STAGE_ENCODE,
+		STAGE_COUNT
+	};
+
+private:
+	const Config& config;
+	FaceRecognizer* recognizer;
+	std::mutex recognizerMutex;
+	std::filesystem::path debugOutputPath;
+	Journal* journal;
+	uint64_t configFingerprint;
+	std::atomic<size_t> skipped = 0;
+	DetectionCache* detectionCache;
+	std::unique_ptr<Deduplicator> deduplicator;
+	std::atomic<size_t> exactDuplicates = 0;
+	std::atomic<size_t> similarDuplicates = 0;
+	FileWriter fileWriter;
+	MemoryBudget memoryBudget;
+	uint64_t detectionModelHash = 0;
+	int analysisLongSide = 0;
+	CompletionCallback completionCallback;
+	ResultCallback resultCallback;
+	// one per output size when writing tar shards or packed files
+	std::vector<std::unique_ptr<TarShardWriter>> tarWriters;
+	std::vector<std::unique_ptr<PackedWriter>> packedWriters;
+	// records in packed files are only readable once close() has written the index, so their
+	// images are recorded as done after that
+	std::mutex packedCommitMutex;
+	std::vector<std::function<void()>> packedCommits;
+
+	WorkStealingQueue<std::unique_ptr<ImageJob>> inputQueue;
+	BoundedQueue<std::unique_ptr<ImageJob>> detectQueue;
+	BoundedQueue<std::unique_ptr<ImageJob>> cropQueue;
+	BoundedQueue<std::unique_ptr<ImageJob>> encodeQueue;
+
+	std::vector<std::thread> threads;
+	std::vector<WorkerStats> stats[STAGE_COUNT];
+	std::chrono::steady_clock::time_point startTime;
+	bool finished = false;
+
+	void prefetchQueued(size_t worker, bool wholeWindow);
+	void decodeWorker(size_t id);
+	void detectWorker(size_t id);
+	void cropWorker(size_t id);
+	void encodeWorker(size_t id);
+	void matchPersons(ImageJob& job);
+	void applyFaceMatches(ImageJob& job);
+	DetectionCache::Key cacheKey(const ImageJob& job) const;
+	bool loadCachedDetections(ImageJob& job, const Yolo& yolo);
+	void storeDetections(const ImageJob& job);
+	bool isDone(ImageJob& job);
+	void recordResult(ImageJob& job, bool ok, const std::filesystem::path& output = std::filesystem::path());
+	void recordSkipped(ImageJob& job);
+	void recordDuplicate(ImageJob& job, const std::filesystem::path& original, bool exact);
+	// records the image as a duplicate if an image with a similar perceptual hash was already seen
+	bool isSimilar(ImageJob& job, const cv::Mat& image);
+	void releaseMemory(ImageJob& job);
+	// estimates the bytes an image holds while in flight, transient is the part only needed while decoding
+	size_t estimateMemory(const ImageJob& job, const unsigned char* data, size_t size, size_t& transient) const;
+	size_t outputIndex(const cv::Size& size) const;
+	const std::vector<cv::Size>& outputSizes(const ImageJob& job) const;
+	bool seamCarving(const ImageJob& job) const;
+	std::string outputFormat(const ImageJob& job) const;
+	// detection and seam carving happen at twice the size of the largest output
+	int analysisLongSideOf(const ImageJob& job) const;
+	std::vector<int> encodeParams(std::string extension) const;
+	void saveDebugImage(const ImageJob& job, size_t target, const cv::Mat& image, const std::vector<Yolo::Detection>& detections);
+	void computeCrops(ImageJob& job, InteligentRoi& intRoi);
+	void loadAnalysisResolution(ImageJob& job);
+	bool cropFromSource(ImageJob& job);
+	bool loadRedetectionModel(std::unique_ptr<Yolo>& yolo, std::unique_ptr<InteligentRoi>& intRoi);
+	void carveAndCrop(ImageJob& job, size_t target, std::unique_ptr<Yolo>& yolo, std::unique_ptr<InteligentRoi>& intRoi);
+
+public:
+	Pipeline(const Config& config, FaceRecognizer* recognizer, const std::filesystem::path& debugOutputPath,
+		Journal* journal = nullptr, DetectionCache* detectionCache = nullptr);
+	~Pipeline();
+	// called from the worker threads once an image has been saved, has failed or was skipped, must be set before the first push
+	void setCompletionCallback(CompletionCallback callback);
+	// called from the encode threads with the detections, crops and output images of every image that got to be saved,
+	// must be set before the first push
+	void setResultCallback(ResultCallback callback);
+	// blocks while the decode stage is far behind
+	void push(const std::filesystem::path& path);
+	// pushes an image that is already in memory, path is only used to name the output, blocks while
+	// the decode stage is behind
+	void push(const std::filesystem::path& path, std::vector<unsigned char>&& data, int64_t mtime = 0,
+		std::shared_ptr<const ImageOptions> options = nullptr);
+	void finish();
+	void logStats() const;
+	const std::vector<WorkerStats>& getStats(Stage stage) const;
+	static const char* stageName(Stage stage);
+	// loads the detection model the workers use, so that a failure can be reported before the pipeline is created
+	static bool checkModels(const Config& config, std::string& error);
+	static std::string sizeDirName(const cv::Size& size);
+	// the directory the images of the given output size are saved to, when there are multiple sizes or buckets each gets a sub directory of base
+	static std::filesystem::path outputDirectory(const Config& config, const cv::Size& size, const std::filesystem::path& base);
+};
@@ -0,0 +1,410 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "log.h"
+#include "options.h"
+#include "tokenize.h"
+#include "pipeline.h"
+#include "utils.h"
+
+// Runs a reference and a candidate configuration over the same images and compares the crops,
+// the detected content each keeps and the output images, so that faster modes can be judged
+// by how much they change the results.
+
+struct QualityConfig
+{
+	std::string referenceArgs;
+	std::string candidateArgs;
+	std::filesystem::path workDir = "smartcrop_quality";
+	std::filesystem::path reportPath;
+	bool perImage = false;
+	std::vector<std::filesystem::path> inputs;
+};
+
+struct OutputRecord
+{
+	cv::Size size;
+	cv::Rect2d crop;
+};
+
+struct ImageRecord
+{
+	// detection boxes relative to the image with their priority
+	std::vector<std::pair<cv::Rect2d, int>> detections;
+	std::vector<OutputRecord> outputs;
+};
+
+struct RunRecord
+{
+	Config config;
+	std::map<std::string, ImageRecord> images;
+	double wallSeconds = 0;
+};
+
+struct Comparison
+{
+	std::string path;
+	double iou = 0;
+	double referenceLost = 0;
+	double candidateLost = 0;
+	// negative when the outputs could not be compared
+	double ssim = -1;
+	double psnr = -1;
+};
+
+static char qualityDoc[] = "Compares the crops and outputs of a candidate configuration against a reference configuration, the report is written as JSON";
+static char qualityArgsDoc[] = "FILE(S)";
+
+static struct argp_option qualityOptions[] =
+{
+  {"reference",		'r', "[ARGS]",		0,	"smartcrop options of the reference configuration, default: the smartcrop defaults"},
+  {"candidate",		'c', "[ARGS]",		0,	"smartcrop options of the candidate configuration"},
+  {"work-dir",		'w', "[DIRECTORY]",	0,	"directory the outputs of both configurations are written to, default: smartcrop_quality"},
+  {"report",		'o', "[FILENAME]",	0,	"write the JSON report to this file instead of stdout"},
+  {"per-image",		'p', 0,			0,	"include the comparison of every image in the report"},
+  {0}
+};
+
+static error_t parseQualityOpt(int key, char *arg, struct argp_state *state)
+{
+	QualityConfig *config = reinterpret_cast<QualityConfig*>(state->input);
+	switch (key)
+	{
+		case 'r':
+			config->referenceArgs = arg;
+			break;
+		case 'c':
+			config->candidateArgs = arg;
+			break;
+		case 'w':
+			config->workDir = arg;
+			break;
+		case 'o':
+			config->reportPath = arg;
+			break;
+		case 'p':
+			config->perImage = true;
+			break;
+		case ARGP_KEY_ARG:
+			config->inputs.push_back(arg);
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp qualityArgp = {qualityOptions, parseQualityOpt, qualityArgsDoc, qualityDoc};
+
+// parses a string of smartcrop options with the smartcrop option parser
+static Config parseConfig(const std::string& args)
+{
+	std::vector<std::string> tokens = tokenizeBinaryIgnore(args, ' ', '"', '\\');
+	std::vector<char*> argv = {const_cast<char*>("smartcrop")};
+	for(std::string& token : tokens)
+	{
+		if(!token.empty())
+			argv.push_back(token.data());
+	}
+
+	Config config;
+	argp_parse(&argp, argv.size(), argv.data(), 0, 0, &config);
+	return config;
+}
+
+static cv::Rect2d relativeRect(const cv::Rect& rect, const cv::Size& base)
+{
+	if(base.width <= 0 || base.height <= 0)
+		return cv::Rect2d();
+	return cv::Rect2d(static_cast<double>(rect.x)/base.width, static_cast<double>(rect.y)/base.height,
+		static_cast<double>(rect.width)/base.width, static_cast<double>(rect.height)/base.height);
+}
+
+static bool runConfig(RunRecord& run, const std::vector<std::filesystem::path>& images)
+{
+	Config& config = run.config;
+	if(!std::filesystem::exists(config.outputDir) && !std::filesystem::create_directories(config.outputDir))
+	{
+		Log(Log::ERROR)<<"could not create directory at "<<config.outputDir;
+		return false;
+	}
+	for(const cv::Size& size : config.outputSizes())
+		std::filesystem::create_directories(Pipeline::outputDirectory(config, size, config.outputDir));
+
+	std::mutex mutex;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Pipeline pipeline(config, nullptr, config.outputDir/"debug");
+	pipeline.setResultCallback([&run, &mutex](const ImageJob& job, bool ok)
+	{
+		if(!ok)
+			return;
+		ImageRecord record;
+		for(const Yolo::Detection& detection : job.detections)
+			record.detections.push_back({relativeRect(detection.box, job.analysisSize), detection.priority});
+		for(const ImageOutput& output : job.outputs)
+			record.outputs.push_back({output.size, relativeRect(output.crop, output.cropBase)});
+		std::lock_guard<std::mutex> lock(mutex);
+		run.images[job.path.string()] = std::move(record);
+	});
+
+	for(const std::filesystem::path& path : images)
+		pipeline.push(path);
+	pipeline.finish();
+	run.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return true;
+}
+
+// the fraction of the priority weighted detection area that lies outside of the crop
+static double lostPriorityArea(const std::vector<std::pair<cv::Rect2d, int>>& detections, const cv::Rect2d& crop)
+{
+	double total = 0;
+	double lost = 0;
+	for(const std::pair<cv::Rect2d, int>& detection : detections)
+	{
+		if(detection.second <= 0)
+			continue;
+		double area = detection.first.area();
+		total += area*detection.second;
+		lost += (area - (detection.first & crop).area())*detection.second;
+	}
+	return total > 0 ? lost/total : 0;
+}
+
+static double intersectionOverUnion(const cv::Rect2d& a, const cv::Rect2d& b)
+{
+	double intersection = (a & b).area();
+	double unionArea = a.area() + b.area() - intersection;
+	return unionArea > 0 ? intersection/unionArea : 1;
+}
+
+// mean structural similarity over all channels with the usual 11x11 gaussian window
+static double structuralSimilarity(const cv::Mat& a, const cv::Mat& b)
+{
+	static constexpr double c1 = 6.5025;
+	static constexpr double c2 = 58.5225;
+
+	cv::Mat x, y;
+	a.convertTo(x, CV_32F);
+	b.convertTo(y, CV_32F);
+
+	cv::Mat xx = x.mul(x);
+	cv::Mat yy = y.mul(y);
+	cv::Mat xy = x.mul(y);
+
+	cv::Mat muX, muY;
+	cv::GaussianBlur(x, muX, cv::Size(11, 11), 1.5);
+	cv::GaussianBlur(y, muY, cv::Size(11, 11), 1.5);
+	cv::Mat muXX = muX.mul(muX);
+	cv::Mat muYY = muY.mul(muY);
+	cv::Mat muXY = muX.mul(muY);
+
+	cv::Mat sigmaXX, sigmaYY, sigmaXY;
+	cv::GaussianBlur(xx, sigmaXX, cv::Size(11, 11), 1.5);
+	sigmaXX -= muXX;
+	cv::GaussianBlur(yy, sigmaYY, cv::Size(11, 11), 1.5);
+	sigmaYY -= muYY;
+	cv::GaussianBlur(xy, sigmaXY, cv::Size(11, 11), 1.5);
+	sigmaXY -= muXY;
+
+	cv::Mat numerator = (2*muXY + c1).mul(2*sigmaXY + c2);
+	cv::Mat denominator = (muXX + muYY + c1).mul(sigmaXX + sigmaYY + c2);
+	cv::Mat map;
+	cv::divide(numerator, denominator, map);
+
+	cv::Scalar channelMeans = cv::mean(map);
+	double sum = 0;
+	for(int i = 0; i < a.channels(); ++i)
+		sum += channelMeans[i];
+	return sum/a.channels();
+}
+
+static void compareOutputs(Comparison& comparison, const std::filesystem::path& path, const cv::Size& size, const RunRecord& reference, const RunRecord& candidate)
+{
+	std::filesystem::path name = path.filename();
+	cv::Mat referenceImage = cv::imread(Pipeline::outputDirectory(reference.config, size, reference.config.outputDir)/name);
+	cv::Mat candidateImage = cv::imread(Pipeline::outputDirectory(candidate.config, size, candidate.config.outputDir)/name);
+	if(referenceImage.empty() || candidateImage.empty() || referenceImage.size() != candidateImage.size())
+		return;
+	comparison.ssim = structuralSimilarity(referenceImage, candidateImage);
+	comparison.psnr = std::min(cv::PSNR(referenceImage, candidateImage), 100.0);
+}
+
+static double mean(const std::vector<double>& values)
+{
+	double sum = 0;
+	for(double value : values)
+		sum += value;
+	return values.empty() ? 0 : sum/values.size();
+}
+
+static double percentile(std::vector<double> values, double fraction)
+{
+	if(values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size()-1, static_cast<size_t>(fraction*values.size()))];
+}
+
+static void writeReport(std::ostream& out, const QualityConfig& quality, const RunRecord& reference, const RunRecord& candidate,
+	const std::vector<Comparison>& comparisons, size_t missing)
+{
+	std::vector<double> ious, referenceLost, candidateLost, ssims, psnrs;
+	for(const Comparison& comparison : comparisons)
+	{
+		ious.push_back(comparison.iou);
+		referenceLost.push_back(comparison.referenceLost);
+		candidateLost.push_back(comparison.candidateLost);
+		if(comparison.ssim >= 0)
+		{
+			ssims.push_back(comparison.ssim);
+			psnrs.push_back(comparison.psnr);
+		}
+	}
+
+	out<<"{\n";
+	out<<"  \"referenceSeconds\": "<<reference.wallSeconds<<", \"candidateSeconds\": "<<candidate.wallSeconds
+		<<", \"speedup\": "<<(candidate.wallSeconds > 0 ? reference.wallSeconds/candidate.wallSeconds : 0)<<",\n";
+	out<<"  \"images\": "<<reference.images.size()<<", \"missingInCandidate\": "<<missing<<", \"outputsCompared\": "<<comparisons.size()<<",\n";
+	out<<"  \"iou\": {\"mean\": "<<mean(ious)<<", \"p10\": "<<percentile(ious, 0.1)<<", \"min\": "<<percentile(ious, 0)<<"},\n";
+	out<<"  \"lostPriorityArea\": {\"reference\": "<<mean(referenceLost)<<", \"candidate\": "<<mean(candidateLost)
+		<<", \"candidateP90\": "<<percentile(candidateLost, 0.9)<<"},\n";
+	out<<"  \"ssim\": {\"mean\": "<<mean(ssims)<<", \"p10\": "<<percentile(ssims, 0.1)<<"},\n";
+	out<<"  \"psnr\": {\"mean\": "<<mean(psnrs)<<", \"p10\": "<<percentile(psnrs, 0.1)<<"}";
+	if(quality.perImage)
+	{
+		out<<",\n  \"perImage\": [\n";
+		for(size_t i = 0; i < comparisons.size(); ++i)
+		{
+			const Comparison& comparison = comparisons[i];
+			out<<"    {\"path\": \""<<escapeJson(comparison.path)<<"\", \"iou\": "<<comparison.iou
+				<<", \"referenceLost\": "<<comparison.referenceLost<<", \"candidateLost\": "<<comparison.candidateLost
+				<<", \"ssim\": "<<comparison.ssim<<", \"psnr\": "<<comparison.psnr<<"}"<<(i+1 < comparisons.size() ? "," : "")<<'\n';
+		}
+		out<<"  ]";
+	}
+	out<<"\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+	QualityConfig quality;
+	argp_parse(&qualityArgp, argc, argv, 0, 0, &quality);
+	// stdout may carry the results
+	Log::toStderr = true;
+	Log::level = Log::WARN;
+
+	std::vector<std::filesystem::path> images;
+	for(const std::filesystem::path& input : quality.inputs)
+		getImageFiles(input, images);
+	std::sort(images.begin(), images.end());
+	if(images.empty())
+	{
+		Log(Log::ERROR)<<"at least one input image or directory is required";
+		return 1;
+	}
+
+	RunRecord reference;
+	RunRecord candidate;
+	reference.config = parseConfig(quality.referenceArgs);
+	candidate.config = parseConfig(quality.candidateArgs);
+	reference.config.outputDir = quality.workDir/"reference";
+	candidate.config.outputDir = quality.workDir/"candidate";
+	for(Config* config : {&reference.config, &candidate.config})
+	{
+		// the outputs are compared by reading them back as individual files
+		config->outputTarSize = 0;
+		config->packedOutput = false;
+		config->debug = false;
+		config->imagePaths.clear();
+	}
+
+	std::cerr<<"Running the reference configuration on "<<images.size()<<" images"<<std::endl;
+	if(!runConfig(reference, images))
+		return 1;
+	std::cerr<<"Running the candidate configuration"<<std::endl;
+	if(!runConfig(candidate, images))
+		return 1;
+
+	std::vector<Comparison> comparisons;
+	size_t missing = 0;
+	for(const std::pair<const std::string, ImageRecord>& referenceImage : reference.images)
+	{
+		auto search = candidate.images.find(referenceImage.first);
+		if(search == candidate.images.end())
+		{
+			++missing;
+			continue;
+		}
+		const ImageRecord& candidateImage = search->second;
+
+		// outputs are paired by size, with buckets each configuration may choose a different one
+		for(size_t i = 0; i < referenceImage.second.outputs.size(); ++i)
+		{
+			const OutputRecord& referenceOutput = referenceImage.second.outputs[i];
+			const OutputRecord* candidateOutput = nullptr;
+			for(const OutputRecord& output : candidateImage.outputs)
+			{
+				if(output.size == referenceOutput.size)
+					candidateOutput = &output;
+			}
+			if(!candidateOutput && i < candidateImage.outputs.size())
+				candidateOutput = &candidateImage.outputs[i];
+			if(!candidateOutput)
+				continue;
+
+			Comparison comparison;
+			comparison.path = referenceImage.first;
+			comparison.iou = intersectionOverUnion(referenceOutput.crop, candidateOutput->crop);
+			comparison.referenceLost = lostPriorityArea(referenceImage.second.detections, referenceOutput.crop);
+			comparison.candidateLost = lostPriorityArea(referenceImage.second.detections, candidateOutput->crop);
+			if(candidateOutput->size == referenceOutput.size)
+				compareOutputs(comparison, referenceImage.first, referenceOutput.size, reference, candidate);
+			comparisons.push_back(comparison);
+		}
+	}
+
+	if(quality.reportPath.empty())
+	{
+		writeReport(std::cout, quality, reference, candidate, comparisons, missing);
+	}
+	else
+	{
+		std::ofstream file(quality.reportPath);
+		if(!file.is_open())
+		{
+			Log(Log::ERROR)<<"could not open "<<quality.reportPath<<" for writing";
+			return 1;
+		}
+		writeReport(file, quality, reference, candidate, comparisons, missing);
+	}
+	return 0;
+}
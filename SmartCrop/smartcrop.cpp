@@ -0,0 +1,184 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "smartcrop.h"
+
+#include <string>
+#include <vector>
+
+#include "cropper.h"
+
+struct smartcrop_options
+{
+	Config config;
+	bool sizesSet = false;
+};
+
+struct smartcrop
+{
+	std::unique_ptr<Cropper> cropper;
+};
+
+// owns the memory the pointers of the public result point into
+struct ResultStorage: public smartcrop_result
+{
+	Cropper::Result cropped;
+	std::vector<smartcrop_detection> detectionStorage;
+	std::vector<smartcrop_output> outputStorage;
+};
+
+static thread_local std::string lastError;
+
+static smartcrop_rect toRect(const cv::Rect& rect)
+{
+	return {rect.x, rect.y, rect.width, rect.height};
+}
+
+smartcrop_options* smartcrop_options_new(void)
+{
+	return new smartcrop_options;
+}
+
+void smartcrop_options_free(smartcrop_options* options)
+{
+	delete options;
+}
+
+int smartcrop_options_add_size(smartcrop_options* options, int width, int height)
+{
+	if(width < 1 || height < 1)
+	{
+		lastError = "invalid size " + std::to_string(width) + 'x' + std::to_string(height);
+		return -1;
+	}
+	if(!options->sizesSet)
+		options->config.targetSizes.clear();
+	options->sizesSet = true;
+	options->config.targetSizes.push_back(cv::Size(width, height));
+	return 0;
+}
+
+void smartcrop_options_set_seam_carving(smartcrop_options* options, int enable)
+{
+	options->config.seamCarving = enable;
+}
+
+int smartcrop_options_set_threads(smartcrop_options* options, int threads)
+{
+	if(threads < 1)
+	{
+		lastError = "invalid thread count " + std::to_string(threads);
+		return -1;
+	}
+	options->config.decodeThreads = threads;
+	options->config.detectThreads = threads;
+	options->config.cropThreads = threads;
+	options->config.encodeThreads = threads;
+	return 0;
+}
+
+void smartcrop_options_set_format(smartcrop_options* options, const char* extension)
+{
+	options->config.outputFormat = extension ? extension : "";
+}
+
+void smartcrop_options_set_model(smartcrop_options* options, const char* model_path, const char* classes_path)
+{
+	options->config.modelPath = model_path ? model_path : "";
+	options->config.classesPath = classes_path ? classes_path : "";
+}
+
+void smartcrop_options_set_focus_person(smartcrop_options* options, const char* image_path, double threshold)
+{
+	options->config.focusPersonImage = image_path ? image_path : "";
+	options->config.threshold = threshold;
+}
+
+smartcrop* smartcrop_new(const smartcrop_options* options)
+{
+	smartcrop_options defaults;
+	if(!options)
+		options = &defaults;
+	try
+	{
+		std::unique_ptr<Cropper> cropper = std::make_unique<Cropper>(options->config);
+		if(!cropper->isOpen())
+		{
+			lastError = cropper->getError();
+			return nullptr;
+		}
+		return new smartcrop{std::move(cropper)};
+	}
+	catch(const std::exception& ex)
+	{
+		lastError = ex.what();
+		return nullptr;
+	}
+}
+
+void smartcrop_free(smartcrop* cropper)
+{
+	delete cropper;
+}
+
+smartcrop_result* smartcrop_process(smartcrop* cropper, const unsigned char* data, size_t size)
+{
+	if(!cropper || !data)
+	{
+		lastError = "invalid argument";
+		return nullptr;
+	}
+
+	ResultStorage* storage = new ResultStorage;
+	storage->cropped = cropper->cropper->process(data, size);
+	const Cropper::Result& cropped = storage->cropped;
+	if(!cropped.ok)
+	{
+		delete storage;
+		lastError = "could not process the image";
+		return nullptr;
+	}
+
+	for(const Yolo::Detection& detection : cropped.detections)
+		storage->detectionStorage.push_back({detection.class_id, detection.className.c_str(), detection.confidence, detection.priority, toRect(detection.box)});
+	for(const Cropper::Output& output : cropped.outputs)
+	{
+		storage->outputStorage.push_back({output.size.width, output.size.height, toRect(output.crop), output.incompleate, output.seamCarved,
+			output.encoded.data(), output.encoded.size()});
+	}
+
+	storage->source_width = cropped.sourceSize.width;
+	storage->source_height = cropped.sourceSize.height;
+	storage->detection_count = storage->detectionStorage.size();
+	storage->detections = storage->detectionStorage.data();
+	storage->output_count = storage->outputStorage.size();
+	storage->outputs = storage->outputStorage.data();
+	return storage;
+}
+
+void smartcrop_result_free(smartcrop_result* result)
+{
+	delete static_cast<ResultStorage*>(result);
+}
+
+const char* smartcrop_last_error(void)
+{
+	return lastError.c_str();
+}
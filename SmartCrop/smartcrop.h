@@ -0,0 +1,97 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// C interface of libsmartcrop. Structures returned by the library are owned by it and only
+// grow at the end, options are set through functions so that new ones can be added without
+// breaking existing callers.
+
+typedef struct smartcrop_options smartcrop_options;
+typedef struct smartcrop smartcrop;
+
+typedef struct
+{
+	int x;
+	int y;
+	int width;
+	int height;
+} smartcrop_rect;
+
+typedef struct
+{
+	int class_id;
+	const char* class_name;
+	float confidence;
+	int priority;
+	smartcrop_rect box;
+} smartcrop_detection;
+
+typedef struct
+{
+	int width;
+	int height;
+	smartcrop_rect crop;
+	int incompleate;
+	int seam_carved;
+	const unsigned char* data;
+	size_t size;
+} smartcrop_output;
+
+typedef struct
+{
+	int source_width;
+	int source_height;
+	size_t detection_count;
+	const smartcrop_detection* detections;
+	size_t output_count;
+	const smartcrop_output* outputs;
+} smartcrop_result;
+
+smartcrop_options* smartcrop_options_new(void);
+void smartcrop_options_free(smartcrop_options* options);
+// the first call replaces the default size of 1024x1024, further calls add sizes,
+// returns 0 on success and -1 if width or height is below 1, the options are then unchanged
+int smartcrop_options_add_size(smartcrop_options* options, int width, int height);
+void smartcrop_options_set_seam_carving(smartcrop_options* options, int enable);
+// returns 0 on success and -1 if threads is below 1, the options are then unchanged
+int smartcrop_options_set_threads(smartcrop_options* options, int threads);
+// extension of the output format such as ".jpg", ".png" or ".webp"
+void smartcrop_options_set_format(smartcrop_options* options, const char* extension);
+void smartcrop_options_set_model(smartcrop_options* options, const char* model_path, const char* classes_path);
+void smartcrop_options_set_focus_person(smartcrop_options* options, const char* image_path, double threshold);
+
+// loads the models, returns NULL on failure, smartcrop_last_error() then describes the problem
+smartcrop* smartcrop_new(const smartcrop_options* options);
+void smartcrop_free(smartcrop* cropper);
+// crops an encoded image, returns NULL if the image could not be processed, thread safe
+smartcrop_result* smartcrop_process(smartcrop* cropper, const unsigned char* data, size_t size);
+void smartcrop_result_free(smartcrop_result* result);
+// the error of the last failed call on this thread
+const char* smartcrop_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
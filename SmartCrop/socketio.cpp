@@ -0,0 +1,248 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "socketio.h"
+
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/tcp.h>
+
+#include "log.h"
+
+int listenTcp(uint16_t port)
+{
+	int fd = socket(AF_INET6, SOCK_STREAM, 0);
+	if(fd < 0)
+	{
+		Log(Log::ERROR)<<"could not create socket: "<<std::strerror(errno);
+		return -1;
+	}
+
+	int on = 1;
+	int off = 0;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+	struct sockaddr_in6 addr = {};
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_any;
+	addr.sin6_port = htons(port);
+	if(bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 64) != 0)
+	{
+		Log(Log::ERROR)<<"could not listen on port "<<port<<": "<<std::strerror(errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int listenUnix(const std::string& path)
+{
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path))
+	{
+		Log(Log::ERROR)<<"socket path "<<path<<" is too long";
+		return -1;
+	}
+	path.copy(addr.sun_path, path.size());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0)
+	{
+		Log(Log::ERROR)<<"could not create socket: "<<std::strerror(errno);
+		return -1;
+	}
+
+	// only a stale socket is replaced, never a regular file or the socket of a running daemon
+	struct stat st;
+	if(lstat(path.c_str(), &st) == 0)
+	{
+		if(!S_ISSOCK(st.st_mode))
+		{
+			Log(Log::ERROR)<<path<<" exists and is not a socket";
+			close(fd);
+			return -1;
+		}
+		if(connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0)
+		{
+			Log(Log::ERROR)<<path<<" is in use by another process";
+			close(fd);
+			return -1;
+		}
+		close(fd);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd < 0)
+		{
+			Log(Log::ERROR)<<"could not create socket: "<<std::strerror(errno);
+			return -1;
+		}
+		unlink(path.c_str());
+	}
+
+	if(bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 64) != 0)
+	{
+		Log(Log::ERROR)<<"could not listen on "<<path<<": "<<std::strerror(errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int connectTcp(const std::string& host, uint16_t port)
+{
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* result;
+	int ret = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result);
+	if(ret != 0)
+	{
+		Log(Log::ERROR)<<"could not resolve "<<host<<": "<<gai_strerror(ret);
+		return -1;
+	}
+
+	int fd = -1;
+	for(struct addrinfo* info = result; info; info = info->ai_next)
+	{
+		fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if(fd < 0)
+			continue;
+		if(connect(fd, info->ai_addr, info->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(result);
+
+	if(fd < 0)
+	{
+		Log(Log::ERROR)<<"could not connect to "<<host<<':'<<port<<": "<<std::strerror(errno);
+		return -1;
+	}
+
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	return fd;
+}
+
+bool parseHostPort(const std::string& str, std::string& host, uint16_t& port)
+{
+	size_t colon = str.rfind(':');
+	std::string portStr = colon == std::string::npos ? str : str.substr(colon+1);
+	if(colon != std::string::npos && colon > 0)
+		host = str.substr(0, colon);
+	if(!host.empty() && host.front() == '[' && host.back() == ']')
+		host = host.substr(1, host.size()-2);
+
+	try
+	{
+		int value = std::stoi(portStr);
+		if(value < 1 || value > 65535)
+			return false;
+		port = value;
+	}
+	catch(const std::logic_error& err)
+	{
+		return false;
+	}
+	return true;
+}
+
+bool writeAll(int fd, const std::string& data)
+{
+	return writeAll(fd, data.data(), data.size());
+}
+
+bool writeAll(int fd, const void* data, size_t size)
+{
+	const char* bytes = static_cast<const char*>(data);
+	size_t written = 0;
+	while(written < size)
+	{
+		ssize_t ret = send(fd, bytes+written, size-written, MSG_NOSIGNAL);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		written += ret;
+	}
+	return true;
+}
+
+LineReader::LineReader(int fdIn, size_t maxLineLengthIn): fd(fdIn), maxLineLength(maxLineLengthIn)
+{
+}
+
+bool LineReader::readLine(std::string& line)
+{
+	while(true)
+	{
+		size_t end = buffer.find('\n', start);
+		if(end != std::string::npos)
+		{
+			line.assign(buffer, start, end-start);
+			start = end+1;
+			return true;
+		}
+
+		buffer.erase(0, start);
+		start = 0;
+		if(maxLineLength > 0 && buffer.size() > maxLineLength)
+			return false;
+		char chunk[4096];
+		ssize_t ret = recv(fd, chunk, sizeof(chunk), 0);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			return false;
+		buffer.append(chunk, ret);
+	}
+}
+
+bool LineReader::read(std::vector<unsigned char>& data, size_t size)
+{
+	size_t buffered = std::min(size, buffer.size()-start);
+	data.assign(buffer.begin()+start, buffer.begin()+start+buffered);
+	start += buffered;
+	data.resize(size);
+
+	size_t received = buffered;
+	while(received < size)
+	{
+		ssize_t ret = recv(fd, data.data()+received, size-received, 0);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			return false;
+		received += ret;
+	}
+	return true;
+}
@@ -0,0 +1,58 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Small helpers for the line based protocols SmartCrop processes talk to each other with.
+// All functions log their errors and return -1 or false on failure.
+
+int listenTcp(uint16_t port);
+
+// replaces a stale socket at path, but fails if path is another kind of file or a socket that is in use
+int listenUnix(const std::string& path);
+
+int connectTcp(const std::string& host, uint16_t port);
+
+// parses HOST:PORT, the host may be omitted in which case it is left unchanged
+bool parseHostPort(const std::string& str, std::string& host, uint16_t& port);
+
+bool writeAll(int fd, const std::string& data);
+
+bool writeAll(int fd, const void* data, size_t size);
+
+class LineReader
+{
+private:
+	int fd;
+	size_t maxLineLength;
+	std::string buffer;
+	size_t start = 0;
+
+public:
+	// maxLineLength of 0 allows lines of any length
+	explicit LineReader(int fd, size_t maxLineLength = 0);
+	// blocks until a whole line is available, returns false once the connection is closed or the line is too long
+	bool readLine(std::string& line);
+	// reads exactly size bytes following the last line
+	bool read(std::vector<unsigned char>& data, size_t size);
+};
@@ -0,0 +1,84 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <string_view>
+#include <initializer_list>
+
+// Append only storage for many small strings. Strings are packed back to back into
+// large blocks and stay valid at the same address until the arena is destroyed,
+// this avoids one heap allocation per string. Not thread safe.
+class StringArena
+{
+private:
+	std::vector<std::unique_ptr<char[]>> blocks;
+	size_t blockSize;
+	size_t used;
+	size_t bytes = 0;
+
+	char* allocate(size_t size)
+	{
+		bytes += size;
+		// oversized strings get a block of their own at the front so the current block stays at the back
+		if(size > blockSize)
+		{
+			blocks.insert(blocks.begin(), std::make_unique<char[]>(size));
+			return blocks.front().get();
+		}
+		if(used + size > blockSize)
+		{
+			blocks.push_back(std::make_unique<char[]>(blockSize));
+			used = 0;
+		}
+		char* out = blocks.back().get()+used;
+		used += size;
+		return out;
+	}
+
+public:
+	explicit StringArena(size_t blockSizeIn = 1 << 20): blockSize(blockSizeIn), used(blockSizeIn)
+	{
+	}
+
+	// stores the concatenation of the given parts as a null terminated string
+	const char* store(std::initializer_list<std::string_view> parts)
+	{
+		size_t size = 1;
+		for(const std::string_view& part : parts)
+			size += part.size();
+		char* out = allocate(size);
+		char* pos = out;
+		for(const std::string_view& part : parts)
+		{
+			std::memcpy(pos, part.data(), part.size());
+			pos += part.size();
+		}
+		*pos = '\0';
+		return out;
+	}
+
+	size_t size() const
+	{
+		return bytes;
+	}
+};
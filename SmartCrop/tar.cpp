@@ -0,0 +1,337 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "tar.h"
+
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "log.h"
+
+static constexpr size_t blockSize = 512;
+
+static uint64_t parseOctal(const char* field, size_t size)
+{
+	// gnu tar stores large values in base 256 with the high bit of the first byte set
+	if(static_cast<unsigned char>(field[0]) & 0x80)
+	{
+		uint64_t value = static_cast<unsigned char>(field[0]) & 0x7f;
+		for(size_t i = 1; i < size; ++i)
+			value = (value << 8) | static_cast<unsigned char>(field[i]);
+		return value;
+	}
+
+	uint64_t value = 0;
+	size_t i = 0;
+	while(i < size && field[i] == ' ')
+		++i;
+	for(; i < size && field[i] >= '0' && field[i] <= '7'; ++i)
+		value = value*8 + (field[i] - '0');
+	return value;
+}
+
+static void writeOctal(char* field, size_t size, uint64_t value)
+{
+	std::snprintf(field, size, "%0*llo", static_cast<int>(size-1), static_cast<unsigned long long>(value));
+}
+
+static std::string fieldString(const char* field, size_t size)
+{
+	return std::string(field, strnlen(field, size));
+}
+
+static unsigned int headerChecksum(const char* block)
+{
+	unsigned int sum = 0;
+	for(size_t i = 0; i < blockSize; ++i)
+		sum += (i >= 148 && i < 156) ? ' ' : static_cast<unsigned char>(block[i]);
+	return sum;
+}
+
+static uint64_t paddedSize(uint64_t size)
+{
+	return (size + blockSize - 1)/blockSize*blockSize;
+}
+
+TarReader::TarReader(const std::filesystem::path& path): file(path, std::ios::binary)
+{
+}
+
+bool TarReader::isOpen() const
+{
+	return file.is_open();
+}
+
+bool TarReader::readBlock(char* block)
+{
+	return static_cast<bool>(file.read(block, blockSize));
+}
+
+bool TarReader::skip(uint64_t size)
+{
+	return static_cast<bool>(file.seekg(paddedSize(size), std::ios::cur));
+}
+
+bool TarReader::readString(uint64_t size, std::string& out)
+{
+	out.resize(paddedSize(size));
+	if(!file.read(out.data(), out.size()))
+		return false;
+	out.resize(size);
+	return true;
+}
+
+bool TarReader::next(Member& member)
+{
+	if(dataPending && !skip(remaining))
+		return false;
+	dataPending = false;
+
+	std::string longName;
+	char block[blockSize];
+	while(readBlock(block))
+	{
+		// two zero blocks end the archive, one is enough to know there are no more members
+		if(block[0] == '\0')
+			return false;
+
+		if(headerChecksum(block) != parseOctal(block+148, 8))
+		{
+			Log(Log::WARN)<<"corrupt tar header, stopping";
+			return false;
+		}
+
+		char type = block[156];
+		uint64_t size = parseOctal(block+124, 12);
+
+		if(type == 'L')
+		{
+			if(!readString(size, longName))
+				return false;
+			longName.resize(strnlen(longName.data(), longName.size()));
+			continue;
+		}
+		else if(type == 'x')
+		{
+			std::string records;
+			if(!readString(size, records))
+				return false;
+			// pax records are "LENGTH key=value\n"
+			size_t pos = 0;
+			while(pos < records.size())
+			{
+				size_t space = records.find(' ', pos);
+				if(space == std::string::npos)
+					break;
+				size_t length = std::strtoull(records.c_str()+pos, nullptr, 10);
+				if(length == 0 || pos+length > records.size())
+					break;
+				std::string record = records.substr(space+1, pos+length-space-2);
+				if(record.compare(0, 5, "path=") == 0)
+					longName = record.substr(5);
+				pos += length;
+			}
+			continue;
+		}
+
+		member.size = size;
+		member.mtime = parseOctal(block+136, 12);
+		member.regular = type == '0' || type == '\0';
+		if(!longName.empty())
+		{
+			member.name = longName;
+		}
+		else
+		{
+			std::string prefix = fieldString(block+345, 155);
+			member.name = fieldString(block, 100);
+			if(!prefix.empty() && std::memcmp(block+257, "ustar", 5) == 0)
+				member.name = prefix + '/' + member.name;
+		}
+		remaining = size;
+		dataPending = true;
+		return true;
+	}
+	return false;
+}
+
+bool TarReader::readData(std::vector<unsigned char>& data)
+{
+	if(!dataPending)
+		return false;
+	data.resize(remaining);
+	if(!file.read(reinterpret_cast<char*>(data.data()), remaining))
+		return false;
+	dataPending = false;
+	return static_cast<bool>(file.seekg(paddedSize(remaining) - remaining, std::ios::cur));
+}
+
+TarWriter::TarWriter(const std::filesystem::path& path)
+{
+	fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+TarWriter::~TarWriter()
+{
+	close();
+}
+
+bool TarWriter::isOpen() const
+{
+	return fd >= 0;
+}
+
+uint64_t TarWriter::size() const
+{
+	return written;
+}
+
+static bool writeAllFd(int fd, const char* data, uint64_t size)
+{
+	uint64_t done = 0;
+	while(done < size)
+	{
+		ssize_t ret = ::write(fd, data+done, size-done);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		done += ret;
+	}
+	return true;
+}
+
+bool TarWriter::writePadded(const char* data, uint64_t size)
+{
+	static const char zeros[blockSize] = {};
+	if(fd < 0 || !writeAllFd(fd, data, size) || !writeAllFd(fd, zeros, paddedSize(size) - size))
+		return false;
+	written += paddedSize(size);
+	return true;
+}
+
+bool TarWriter::writeHeader(const std::string& name, uint64_t size, int64_t mtime, char type)
+{
+	char block[blockSize] = {};
+	std::memcpy(block, name.data(), std::min(name.size(), static_cast<size_t>(100)));
+	writeOctal(block+100, 8, 0644);
+	writeOctal(block+108, 8, 0);
+	writeOctal(block+116, 8, 0);
+	writeOctal(block+124, 12, size);
+	writeOctal(block+136, 12, mtime);
+	block[156] = type;
+	std::memcpy(block+257, "ustar", 6);
+	std::memcpy(block+263, "00", 2);
+	std::snprintf(block+148, 8, "%06o", headerChecksum(block));
+	block[155] = ' ';
+	return writePadded(block, blockSize);
+}
+
+uint64_t TarWriter::memberSize(const std::string& name, uint64_t size)
+{
+	uint64_t headers = blockSize;
+	if(name.size() > 100)
+		headers += blockSize + paddedSize(name.size() + 1);
+	return headers + paddedSize(size);
+}
+
+uint64_t TarWriter::trailerSize()
+{
+	return blockSize*2;
+}
+
+bool TarWriter::write(const std::string& name, const unsigned char* data, uint64_t size, int64_t mtime)
+{
+	if(name.size() > 100)
+	{
+		std::string longName = name + '\0';
+		if(!writeHeader("././@LongLink", longName.size(), 0, 'L') || !writePadded(longName.data(), longName.size()))
+			return false;
+	}
+	if(!writeHeader(name, size, mtime, '0'))
+		return false;
+	return writePadded(reinterpret_cast<const char*>(data), size);
+}
+
+void TarWriter::close()
+{
+	if(fd < 0)
+		return;
+	static const char zeros[blockSize*2] = {};
+	if(!writeAllFd(fd, zeros, sizeof(zeros)) || fsync(fd) != 0)
+		Log(Log::WARN)<<"could not finish archive: "<<std::strerror(errno);
+	::close(fd);
+	fd = -1;
+}
+
+TarShardWriter::TarShardWriter(const std::filesystem::path& directoryIn, const std::string& prefixIn, uint64_t maxSizeIn):
+	directory(directoryIn), prefix(prefixIn), maxSize(maxSizeIn)
+{
+}
+
+bool TarShardWriter::openNext()
+{
+	if(current)
+	{
+		current->close();
+		Log(Log::INFO)<<"Finished "<<currentPath<<" with "<<current->size()<<" bytes";
+	}
+
+	char number[16];
+	do
+	{
+		std::snprintf(number, sizeof(number), "%06zu", index++);
+		currentPath = directory/(prefix + '-' + number + ".tar");
+	} while(std::filesystem::exists(currentPath));
+
+	current = std::make_unique<TarWriter>(currentPath);
+	if(!current->isOpen())
+	{
+		Log(Log::ERROR)<<"could not create "<<currentPath;
+		current.reset();
+		return false;
+	}
+	return true;
+}
+
+std::filesystem::path TarShardWriter::write(const std::string& name, const std::vector<unsigned char>& data)
+{
+	int64_t mtime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	// a member bigger than maxSize still gets written, into an archive of its own
+	if(!current || (current->size() > 0 &&
+		current->size() + TarWriter::memberSize(name, data.size()) + TarWriter::trailerSize() > maxSize))
+	{
+		if(!openNext())
+			return std::filesystem::path();
+	}
+	if(!current->write(name, data.data(), data.size(), mtime))
+		return std::filesystem::path();
+	return currentPath;
+}
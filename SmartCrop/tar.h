@@ -0,0 +1,105 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+// Sequential reader for ustar archives, including gnu long names and pax path records,
+// as used by WebDataset shards. Members are read one after another without seeking back.
+class TarReader
+{
+public:
+	struct Member
+	{
+		std::string name;
+		uint64_t size = 0;
+		int64_t mtime = 0;
+		bool regular = false;
+	};
+
+private:
+	std::ifstream file;
+	uint64_t remaining = 0;
+	bool dataPending = false;
+
+	bool readBlock(char* block);
+	bool readString(uint64_t size, std::string& out);
+	bool skip(uint64_t size);
+
+public:
+	explicit TarReader(const std::filesystem::path& path);
+	bool isOpen() const;
+	// advances to the next member, any unread data of the current member is skipped
+	bool next(Member& member);
+	bool readData(std::vector<unsigned char>& data);
+};
+
+// Writes ustar archives, names longer than the header allows are stored as gnu long names.
+// Members are written straight to the file descriptor without buffering in the process, so
+// that once write() returns a sync of the file system covers them.
+class TarWriter
+{
+private:
+	int fd = -1;
+	uint64_t written = 0;
+
+	bool writeHeader(const std::string& name, uint64_t size, int64_t mtime, char type);
+	bool writePadded(const char* data, uint64_t size);
+
+public:
+	explicit TarWriter(const std::filesystem::path& path);
+	~TarWriter();
+	bool isOpen() const;
+	bool write(const std::string& name, const unsigned char* data, uint64_t size, int64_t mtime = 0);
+	// bytes write() adds to the archive for a member, including its headers
+	static uint64_t memberSize(const std::string& name, uint64_t size);
+	// bytes of the end of archive marker close() writes
+	static uint64_t trailerSize();
+	// writes the end of archive marker and syncs the archive to disk, called by the destructor
+	void close();
+	uint64_t size() const;
+};
+
+// Writes members into a series of archives named PREFIX-NNNNNN.tar in a directory, starting a new
+// archive whenever the current one would exceed maxSize. Numbering continues after archives
+// that already exist so that resumed runs do not overwrite earlier output. Thread safe.
+class TarShardWriter
+{
+private:
+	std::filesystem::path directory;
+	std::string prefix;
+	uint64_t maxSize;
+	size_t index = 0;
+	std::unique_ptr<TarWriter> current;
+	std::filesystem::path currentPath;
+	std::mutex mutex;
+
+	bool openNext();
+
+public:
+	TarShardWriter(const std::filesystem::path& directory, const std::string& prefix, uint64_t maxSize);
+	// returns the archive the member was written to or an empty path on failure
+	std::filesystem::path write(const std::string& name, const std::vector<unsigned char>& data);
+};
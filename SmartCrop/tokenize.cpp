@@ -44,3 +44,79 @@ std::vector<std::string> tokenizeBinaryIgnore(const std::string& str, const char
 		tokens.push_back(token);
 	return tokens;
 }
+
+std::string escapeSeperators(const std::string& str)
+{
+	std::string out;
+	out.reserve(str.size());
+	for(char ch : str)
+	{
+		if(ch == '\\')
+			out += "\\\\";
+		else if(ch == '\t')
+			out += "\\t";
+		else if(ch == '\n')
+			out += "\\n";
+		else
+			out.push_back(ch);
+	}
+	return out;
+}
+
+std::string unescapeSeperators(const std::string& str)
+{
+	std::string out;
+	out.reserve(str.size());
+	for(size_t i = 0; i < str.size(); ++i)
+	{
+		if(str[i] == '\\' && i+1 < str.size())
+		{
+			++i;
+			if(str[i] == 't')
+				out.push_back('\t');
+			else if(str[i] == 'n')
+				out.push_back('\n');
+			else
+				out.push_back(str[i]);
+		}
+		else
+		{
+			out.push_back(str[i]);
+		}
+	}
+	return out;
+}
+
+std::string escapeJson(const std::string& str)
+{
+	static const char hex[] = "0123456789abcdef";
+	std::string out;
+	out.reserve(str.size());
+	for(char ch : str)
+	{
+		if(ch == '"' || ch == '\\')
+		{
+			out.push_back('\\');
+			out.push_back(ch);
+		}
+		else if(ch == '\n')
+		{
+			out += "\\n";
+		}
+		else if(ch == '\t')
+		{
+			out += "\\t";
+		}
+		else if(static_cast<unsigned char>(ch) < 0x20)
+		{
+			out += "\\u00";
+			out.push_back(hex[ch >> 4]);
+			out.push_back(hex[ch & 0xf]);
+		}
+		else
+		{
+			out.push_back(ch);
+		}
+	}
+	return out;
+}
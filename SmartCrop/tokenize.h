@@ -24,3 +24,11 @@
 
 std::vector<std::string> tokenizeBinaryIgnore(const std::string& str, const char delim, const char ignoreBraket = '\0',
 											  const char escapeChar = '\0');
+
+// escapes backslashes, tabs and newlines so that the string can be stored as a tab seperated field of a line
+std::string escapeSeperators(const std::string& str);
+
+std::string unescapeSeperators(const std::string& str);
+
+// escapes the string for use inside of a quoted JSON string
+std::string escapeJson(const std::string& str);
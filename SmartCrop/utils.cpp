@@ -24,9 +24,23 @@
 #include <vector>
 #include <opencv2/imgproc.hpp>
 
+bool hasImageExtension(const std::string_view& name)
+{
+	auto endsWith = [&name](const std::string_view& suffix)
+	{
+		return name.size() > suffix.size() && name.compare(name.size()-suffix.size(), suffix.size(), suffix) == 0;
+	};
+	return endsWith(".png") || endsWith(".jpg") || endsWith(".jpeg");
+}
+
+bool hasTarExtension(const std::string_view& name)
+{
+	return name.size() > 4 && name.compare(name.size()-4, 4, ".tar") == 0;
+}
+
 bool isImagePath(const std::filesystem::path& path)
 {
-	return std::filesystem::is_regular_file(path) && (path.extension() == ".png" || path.extension() == ".jpg" || path.extension() == ".jpeg");
+	return std::filesystem::is_regular_file(path) && hasImageExtension(path.filename().native());
 }
 
 void getImageFiles(const std::filesystem::path& path, std::vector<std::filesystem::path>& paths)
@@ -21,8 +21,13 @@
 
 #include <filesystem>
 #include <vector>
+#include <string_view>
 #include <opencv2/imgproc.hpp>
 
+bool hasImageExtension(const std::string_view& name);
+
+bool hasTarExtension(const std::string_view& name);
+
 bool isImagePath(const std::filesystem::path& path);
 
 void getImageFiles(const std::filesystem::path& path, std::vector<std::filesystem::path>& paths);
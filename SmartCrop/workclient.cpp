@@ -0,0 +1,190 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "workclient.h"
+
+#include <vector>
+#include <chrono>
+#include <unistd.h>
+
+#include "tokenize.h"
+#include "utils.h"
+#include "log.h"
+
+WorkClient::WorkClient(const std::string& host, uint16_t port): fd(connectTcp(host, port)), reader(fd)
+{
+	if(fd >= 0)
+		Log(Log::INFO)<<"Connected to coordinator at "<<host<<':'<<port;
+}
+
+WorkClient::~WorkClient()
+{
+	if(fd >= 0)
+		close(fd);
+}
+
+bool WorkClient::isOpen() const
+{
+	return fd >= 0;
+}
+
+bool WorkClient::run(const std::function<void(const std::filesystem::path&)>& push, size_t leaseSize)
+{
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [this, leaseSize](){return leaseOf.size() < leaseSize;});
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(writeMutex);
+			if(!writeAll(fd, "LEASE " + std::to_string(leaseSize) + '\n'))
+				break;
+		}
+
+		std::string line;
+		if(!reader.readLine(line))
+			break;
+
+		if(line == "DONE")
+			return true;
+
+		if(line == "WAIT")
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait_for(lock, std::chrono::seconds(1));
+			continue;
+		}
+
+		std::vector<std::string> tokens = tokenizeBinaryIgnore(line, ' ');
+		uint64_t id;
+		size_t count;
+		try
+		{
+			if(tokens.size() != 3 || tokens[0] != "LEASE")
+				throw std::invalid_argument(line);
+			id = std::stoull(tokens[1]);
+			count = std::stoull(tokens[2]);
+		}
+		catch(const std::logic_error& err)
+		{
+			Log(Log::ERROR)<<"unexpected reply from coordinator: "<<line;
+			break;
+		}
+
+		std::vector<std::filesystem::path> paths;
+		for(size_t i = 0; i < count; ++i)
+		{
+			if(!reader.readLine(line))
+				break;
+			std::string path = unescapeSeperators(line);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				leaseOf[path] = id;
+				if(hasTarExtension(path))
+					archives[path] = Archive();
+			}
+			paths.push_back(path);
+		}
+		if(paths.size() != count)
+			break;
+
+		Log(Log::DEBUG)<<"Got lease "<<id<<" with "<<count<<" images";
+		for(const std::filesystem::path& path : paths)
+			push(path);
+	}
+
+	Log(Log::ERROR)<<"lost connection to the coordinator";
+	return false;
+}
+
+bool WorkClient::takeAck(const std::filesystem::path& path, bool& ok, std::string& leased, uint64_t& id)
+{
+	leased = path.native();
+	// images from an archive are named archive/member
+	for(std::filesystem::path parent = path.parent_path(); !archives.count(leased) && !parent.empty(); parent = parent.parent_path())
+	{
+		if(archives.count(parent.native()))
+			leased = parent.native();
+		else if(parent == parent.parent_path())
+			break;
+	}
+
+	auto archive = archives.find(leased);
+	if(archive != archives.end())
+	{
+		if(leased != path.native())
+		{
+			++archive->second.completed;
+			archive->second.ok = archive->second.ok && ok;
+		}
+		if(!archive->second.expanded || archive->second.completed < archive->second.members)
+			return false;
+		ok = archive->second.ok;
+		archives.erase(archive);
+	}
+
+	auto search = leaseOf.find(leased);
+	if(search == leaseOf.end())
+		return false;
+	id = search->second;
+	leaseOf.erase(search);
+	return true;
+}
+
+void WorkClient::sendAck(uint64_t id, bool ok, const std::string& path)
+{
+	cond.notify_all();
+	std::lock_guard<std::mutex> lock(writeMutex);
+	if(!writeAll(fd, "ACK " + std::to_string(id) + (ok ? " ok " : " failed ") + escapeSeperators(path) + '\n'))
+		Log(Log::WARN)<<"could not ack "<<path<<" to the coordinator";
+}
+
+void WorkClient::complete(const std::filesystem::path& path, bool ok)
+{
+	std::string leased;
+	uint64_t id;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(!takeAck(path, ok, leased, id))
+			return;
+	}
+	sendAck(id, ok, leased);
+}
+
+void WorkClient::archiveExpanded(const std::filesystem::path& path, size_t count, bool ok)
+{
+	std::string leased;
+	uint64_t id;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto archive = archives.find(path.native());
+		if(archive == archives.end())
+			return;
+		archive->second.members = count;
+		archive->second.expanded = true;
+		archive->second.ok = archive->second.ok && ok;
+		if(!takeAck(path, ok, leased, id))
+			return;
+	}
+	sendAck(id, ok, leased);
+}
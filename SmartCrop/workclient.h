@@ -0,0 +1,69 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "socketio.h"
+
+// Worker side of the WorkServer protocol, pulls leases from a coordinator and acks every
+// image once the pipeline is done with it.
+class WorkClient
+{
+private:
+	int fd;
+	LineReader reader;
+	std::mutex writeMutex;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::unordered_map<std::string, uint64_t> leaseOf;
+
+	// leased archives, which are acked once every image in them is complete
+	struct Archive
+	{
+		size_t members = 0;
+		size_t completed = 0;
+		bool expanded = false;
+		bool ok = true;
+	};
+	std::unordered_map<std::string, Archive> archives;
+
+	// returns true with the leased path and its lease once path completes it
+	bool takeAck(const std::filesystem::path& path, bool& ok, std::string& leased, uint64_t& id);
+	void sendAck(uint64_t id, bool ok, const std::string& path);
+
+public:
+	WorkClient(const std::string& host, uint16_t port);
+	~WorkClient();
+	bool isOpen() const;
+	// hands leased images to push, keeping at most about 2*leaseSize images in flight, until the
+	// coordinator reports that all work is done. Returns false if the connection was lost.
+	bool run(const std::function<void(const std::filesystem::path&)>& push, size_t leaseSize);
+	// called from the pipeline when an image is finished, images from an archive are named archive/member
+	void complete(const std::filesystem::path& path, bool ok);
+	// called once every image of the leased archive at path has been pushed, ok is false if it could not be read completely
+	void archiveExpanded(const std::filesystem::path& path, size_t count, bool ok);
+};
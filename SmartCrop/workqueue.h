@@ -0,0 +1,274 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+struct WorkerStats
+{
+	size_t processed = 0;
+	size_t stolen = 0;
+	std::chrono::duration<double> busy = std::chrono::duration<double>::zero();
+};
+
+// Each worker owns a deque that it pops from the front of, when it runs dry
+// it steals from the back of the other workers deques. Items can be pushed while
+// workers are running, pop() blocks until an item is available or the queue is closed.
+template<typename T>
+class WorkStealingQueue
+{
+private:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<T> items;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<size_t> nextPush = 0;
+	std::atomic<size_t> pending = 0;
+	std::mutex waitMutex;
+	std::condition_variable cond;
+	std::condition_variable drained;
+	size_t drainWaiters = 0;
+	bool closed = false;
+
+	void notifyDrained()
+	{
+		std::lock_guard<std::mutex> lock(waitMutex);
+		if(drainWaiters > 0)
+			drained.notify_all();
+	}
+
+	bool tryPopOwn(size_t worker, T& item)
+	{
+		Worker& own = *workers[worker];
+		std::unique_lock<std::mutex> lock(own.mutex);
+		if(own.items.empty())
+			return false;
+		item = std::move(own.items.front());
+		own.items.pop_front();
+		--pending;
+		lock.unlock();
+		notifyDrained();
+		return true;
+	}
+
+	bool trySteal(size_t worker, T& item)
+	{
+		for(size_t i = 1; i < workers.size(); ++i)
+		{
+			Worker& victim = *workers[(worker+i) % workers.size()];
+			std::unique_lock<std::mutex> lock(victim.mutex);
+			if(victim.items.empty())
+				continue;
+			item = std::move(victim.items.back());
+			victim.items.pop_back();
+			--pending;
+			lock.unlock();
+			notifyDrained();
+			return true;
+		}
+		return false;
+	}
+
+public:
+	explicit WorkStealingQueue(size_t workerCount)
+	{
+		if(workerCount == 0)
+			workerCount = 1;
+		for(size_t i = 0; i < workerCount; ++i)
+			workers.push_back(std::make_unique<Worker>());
+	}
+
+	size_t workerCount() const
+	{
+		return workers.size();
+	}
+
+	void push(T item)
+	{
+		Worker& target = *workers[nextPush++ % workers.size()];
+		{
+			std::lock_guard<std::mutex> lock(waitMutex);
+			++pending;
+		}
+		{
+			std::lock_guard<std::mutex> lock(target.mutex);
+			target.items.push_back(std::move(item));
+		}
+		cond.notify_one();
+	}
+
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(waitMutex);
+			closed = true;
+		}
+		cond.notify_all();
+		drained.notify_all();
+	}
+
+	// blocks until fewer than limit items are waiting, used by producers that would otherwise outrun the workers
+	void waitBelow(size_t limit)
+	{
+		std::unique_lock<std::mutex> lock(waitMutex);
+		++drainWaiters;
+		drained.wait(lock, [this, limit](){return pending < limit || closed;});
+		--drainWaiters;
+	}
+
+	// calls f with the item at position in the workers own deque if there is one, f runs under the deques lock
+	template<typename F>
+	bool visit(size_t worker, size_t position, F f)
+	{
+		Worker& own = *workers[worker];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if(position >= own.items.size())
+			return false;
+		f(own.items[position]);
+		return true;
+	}
+
+	bool pop(size_t worker, T& item, bool* stolen = nullptr)
+	{
+		while(true)
+		{
+			if(tryPopOwn(worker, item))
+			{
+				if(stolen)
+					*stolen = false;
+				return true;
+			}
+			if(trySteal(worker, item))
+			{
+				if(stolen)
+					*stolen = true;
+				return true;
+			}
+
+			std::unique_lock<std::mutex> lock(waitMutex);
+			cond.wait(lock, [this](){return pending > 0 || closed;});
+			if(closed && pending == 0)
+				return false;
+		}
+	}
+};
+
+// A blocking multi producer multi consumer queue with a fixed capacity. The queue
+// closes itself once the last registered producer has called removeProducer(),
+// after which pop() drains the remaining items and then returns false.
+template<typename T>
+class BoundedQueue
+{
+private:
+	std::deque<T> items;
+	size_t capacity;
+	size_t producers = 0;
+	bool closed = false;
+	std::mutex mutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+
+public:
+	explicit BoundedQueue(size_t capacityIn = 1): capacity(capacityIn > 0 ? capacityIn : 1)
+	{
+	}
+
+	void addProducer()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++producers;
+	}
+
+	void removeProducer()
+	{
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			last = --producers == 0;
+		}
+		if(last)
+			close();
+	}
+
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+		}
+		notEmpty.notify_all();
+		notFull.notify_all();
+	}
+
+	bool push(T item)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			notFull.wait(lock, [this](){return items.size() < capacity || closed;});
+			if(closed)
+				return false;
+			items.push_back(std::move(item));
+		}
+		notEmpty.notify_one();
+		return true;
+	}
+
+	bool pop(T& item)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			notEmpty.wait(lock, [this](){return !items.empty() || closed;});
+			if(items.empty())
+				return false;
+			item = std::move(items.front());
+			items.pop_front();
+		}
+		notFull.notify_one();
+		return true;
+	}
+
+	bool tryPop(T& item)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(items.empty())
+				return false;
+			item = std::move(items.front());
+			items.pop_front();
+		}
+		notFull.notify_one();
+		return true;
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return items.size();
+	}
+};
@@ -0,0 +1,291 @@
+//
+// SmartCrop - A tool for content aware croping of images
+// Copyright (C) 2024 Carl Philipp Klemm
+//
+// This file is part of SmartCrop.
+//
+// SmartCrop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// SmartCrop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "workserver.h"
+
+#include <algorithm>
+#include <sstream>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "socketio.h"
+#include "tokenize.h"
+#include "log.h"
+
+// paths are the longest lines of the protocol
+static constexpr size_t maxLineLength = 64*1024;
+
+WorkServer::WorkServer(uint16_t port, std::chrono::seconds leaseTimeoutIn): leaseTimeout(leaseTimeoutIn)
+{
+	listenFd = listenTcp(port);
+	if(listenFd >= 0)
+		Log(Log::INFO)<<"Serving work queue on port "<<port;
+}
+
+WorkServer::~WorkServer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		for(int fd : clientFds)
+			shutdown(fd, SHUT_RDWR);
+	}
+	for(std::thread& thread : clientThreads)
+		thread.join();
+	for(int fd : clientFds)
+		close(fd);
+	if(listenFd >= 0)
+		close(listenFd);
+}
+
+bool WorkServer::isOpen() const
+{
+	return listenFd >= 0;
+}
+
+void WorkServer::push(const std::filesystem::path& path)
+{
+	std::string absolute = std::filesystem::absolute(path).lexically_normal().string();
+	std::lock_guard<std::mutex> lock(mutex);
+	if(outstanding.emplace(absolute, 0).second)
+		queue.push_back(absolute);
+}
+
+void WorkServer::enumerationFinished()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	enumerationDone = true;
+}
+
+bool WorkServer::isFinished()
+{
+	return enumerationDone && outstanding.empty();
+}
+
+void WorkServer::releaseLease(uint64_t id)
+{
+	auto search = leases.find(id);
+	if(search == leases.end())
+		return;
+	for(auto path = search->second.paths.rbegin(); path != search->second.paths.rend(); ++path)
+	{
+		outstanding[*path] = 0;
+		queue.push_front(*path);
+		++reissued;
+	}
+	leases.erase(search);
+}
+
+void WorkServer::expireLeases()
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::vector<uint64_t> expired;
+	for(const std::pair<const uint64_t, Lease>& lease : leases)
+	{
+		if(lease.second.expiry < now)
+			expired.push_back(lease.first);
+	}
+	for(uint64_t id : expired)
+	{
+		Log(Log::WARN)<<"lease "<<id<<" expired, reissuing "<<leases[id].paths.size()<<" images";
+		releaseLease(id);
+	}
+}
+
+bool WorkServer::failedBy(const std::string& path, int client) const
+{
+	auto search = failures.find(path);
+	if(search == failures.end())
+		return false;
+	const std::vector<int>& clients = search->second;
+	if(std::find(clients.begin(), clients.end(), client) == clients.end())
+		return false;
+	// once every connected worker failed it, it goes to whoever asks
+	std::vector<int> distinct = clients;
+	std::sort(distinct.begin(), distinct.end());
+	distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+	return distinct.size() < connectedClients;
+}
+
+std::string WorkServer::lease(size_t count, int client)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	expireLeases();
+
+	Lease lease;
+	lease.client = client;
+	lease.expiry = std::chrono::steady_clock::now() + leaseTimeout;
+	uint64_t id = nextLease;
+	std::vector<std::string> deferred;
+	while(lease.paths.size() < count && !queue.empty())
+	{
+		std::string path = std::move(queue.front());
+		queue.pop_front();
+		// images that where acked from an expired lease are still in the queue
+		auto search = outstanding.find(path);
+		if(search == outstanding.end() || search->second != 0)
+			continue;
+		if(failedBy(path, client))
+		{
+			deferred.push_back(std::move(path));
+			continue;
+		}
+		search->second = id;
+		lease.paths.push_back(std::move(path));
+	}
+	for(auto path = deferred.rbegin(); path != deferred.rend(); ++path)
+		queue.push_front(std::move(*path));
+
+	if(lease.paths.empty())
+		return isFinished() ? "DONE\n" : "WAIT\n";
+
+	++nextLease;
+	std::stringstream ss;
+	ss<<"LEASE "<<id<<' '<<lease.paths.size()<<'\n';
+	for(const std::string& path : lease.paths)
+		ss<<escapeSeperators(path)<<'\n';
+	leases.emplace(id, std::move(lease));
+	return ss.str();
+}
+
+void WorkServer::ack(uint64_t id, bool ok, const std::string& path, int client)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto search = outstanding.find(path);
+	if(search == outstanding.end())
+		return;
+
+	auto leaseSearch = leases.find(search->second);
+	if(leaseSearch != leases.end())
+	{
+		std::vector<std::string>& paths = leaseSearch->second.paths;
+		paths.erase(std::remove(paths.begin(), paths.end(), path), paths.end());
+		if(paths.empty())
+			leases.erase(leaseSearch);
+	}
+	auto ackedLease = leases.find(id);
+	if(ackedLease != leases.end())
+		ackedLease->second.expiry = std::chrono::steady_clock::now() + leaseTimeout;
+
+	if(!ok)
+	{
+		std::vector<int>& clients = failures[path];
+		clients.push_back(client);
+		if(clients.size() < maxAttempts)
+		{
+			Log(Log::WARN)<<path<<" failed on a worker, queuing it again";
+			search->second = 0;
+			queue.push_back(path);
+			++retried;
+			return;
+		}
+		Log(Log::WARN)<<path<<" failed "<<clients.size()<<" times, giving up";
+	}
+	failures.erase(path);
+	outstanding.erase(search);
+	if(ok)
+		++completed;
+	else
+		++failed;
+}
+
+void WorkServer::handleClient(int fd)
+{
+	LineReader reader(fd, maxLineLength);
+	std::string line;
+	while(reader.readLine(line))
+	{
+		std::vector<std::string> tokens = tokenizeBinaryIgnore(line, ' ');
+		try
+		{
+			if(tokens.size() == 2 && tokens[0] == "LEASE")
+			{
+				if(!writeAll(fd, lease(std::stoull(tokens[1]), fd)))
+					break;
+			}
+			else if(tokens.size() >= 4 && tokens[0] == "ACK")
+			{
+				// the path may contain spaces, so it is everything after the third space
+				size_t pathStart = tokens[0].size() + tokens[1].size() + tokens[2].size() + 3;
+				ack(std::stoull(tokens[1]), tokens[2] == "ok", unescapeSeperators(line.substr(pathStart)), fd);
+			}
+			else
+			{
+				Log(Log::WARN)<<"ignoring malformed request from worker: "<<line;
+			}
+		}
+		catch(const std::logic_error& err)
+		{
+			Log(Log::WARN)<<"ignoring malformed request from worker: "<<line;
+		}
+	}
+
+	// whatever the worker did not finish goes back into the queue
+	std::lock_guard<std::mutex> lock(mutex);
+	--connectedClients;
+	std::vector<uint64_t> abandoned;
+	for(const std::pair<const uint64_t, Lease>& lease : leases)
+	{
+		if(lease.second.client == fd)
+			abandoned.push_back(lease.first);
+	}
+	for(uint64_t id : abandoned)
+		releaseLease(id);
+	if(!stopping)
+		Log(Log::INFO)<<"Worker disconnected, "<<abandoned.size()<<" leases returned to the queue";
+}
+
+void WorkServer::run()
+{
+	while(true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			expireLeases();
+			if(isFinished())
+				break;
+		}
+
+		struct pollfd pfd = {listenFd, POLLIN, 0};
+		if(poll(&pfd, 1, 1000) <= 0)
+			continue;
+		int fd = accept(listenFd, nullptr, nullptr);
+		if(fd < 0)
+			continue;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		++connectedClients;
+		clientFds.push_back(fd);
+		clientThreads.push_back(std::thread(&WorkServer::handleClient, this, fd));
+		Log(Log::INFO)<<"Worker connected";
+	}
+
+	// give workers that are waiting for a lease a last chance to be told that everything is done
+	std::this_thread::sleep_for(std::chrono::seconds(2));
+}
+
+void WorkServer::logStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Log(Log::INFO)<<"Completed "<<completed<<" images, "<<failed<<" failed, "<<reissued<<" reissued after expired or abandoned leases, "
+		<<retried<<" retried after failing";
+}
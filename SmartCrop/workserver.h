@@ -0,0 +1,94 @@
+/* * SmartCrop - A tool for content aware croping of images
+ * Copyright (C) 2024 Carl Philipp Klemm
+ *
+ * This file is part of SmartCrop.
+ *
+ * SmartCrop is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * SmartCrop is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SmartCrop.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+// Coordinator that hands out the images to process to worker processes over TCP.
+//
+// The protocol is line based, paths are escaped with escapeSeperators():
+//   worker: LEASE <count>                 coordinator: LEASE <id> <n> followed by n path lines,
+//                                                      WAIT if nothing is available right now or
+//                                                      DONE once every image has been completed
+//   worker: ACK <id> ok|failed <path>     no reply, also renews the lease
+//
+// Leases that are not acked within the timeout, or whose worker disconnects, are put back
+// at the front of the queue and handed out again. Images acked as failed are queued again for a
+// worker that did not fail them yet, until they failed maxAttempts times.
+class WorkServer
+{
+private:
+	struct Lease
+	{
+		std::vector<std::string> paths;
+		std::chrono::steady_clock::time_point expiry;
+		int client;
+	};
+
+	int listenFd = -1;
+	std::chrono::seconds leaseTimeout;
+	std::mutex mutex;
+	std::deque<std::string> queue;
+	// every image that is not completed yet and the lease it is in, 0 while it is queued
+	std::unordered_map<std::string, uint64_t> outstanding;
+	std::unordered_map<uint64_t, Lease> leases;
+	uint64_t nextLease = 1;
+	bool enumerationDone = false;
+	bool stopping = false;
+	size_t completed = 0;
+	size_t failed = 0;
+	size_t reissued = 0;
+	size_t retried = 0;
+	// the workers that failed an image that is queued again
+	std::unordered_map<std::string, std::vector<int>> failures;
+	size_t connectedClients = 0;
+	std::vector<std::thread> clientThreads;
+	std::vector<int> clientFds;
+
+	void handleClient(int fd);
+	void releaseLease(uint64_t id);
+	void expireLeases();
+	bool isFinished();
+	std::string lease(size_t count, int client);
+	void ack(uint64_t id, bool ok, const std::string& path, int client);
+	// whether the image should rather be leased to another worker
+	bool failedBy(const std::string& path, int client) const;
+
+public:
+	static constexpr size_t maxAttempts = 3;
+
+	WorkServer(uint16_t port, std::chrono::seconds leaseTimeout);
+	~WorkServer();
+	bool isOpen() const;
+	void push(const std::filesystem::path& path);
+	// must be called once all images have been pushed, run() does not return before
+	void enumerationFinished();
+	// serves workers until every image has been completed
+	void run();
+	void logStats();
+};
@@ -27,6 +27,7 @@
 #include "readfile.h"
 #include "tokenize.h"
 #include "log.h"
+#include "hash.h"
 
 #define INCBIN_PREFIX r
 #include "incbin.h"
@@ -74,19 +75,54 @@ Yolo::Yolo(const std::filesystem::path &onnxModelPath, const cv::Size &modelInpu
 
 std::vector<Yolo::Detection> Yolo::runInference(const cv::Mat &input)
 {
-	cv::Mat modelInput = input;
-	if (letterBoxForSquare && modelShape.width == modelShape.height)
-		modelInput = formatToSquare(modelInput);
+	return runInference(std::vector<cv::Mat>{input})[0];
+}
+
+std::vector<std::vector<Yolo::Detection>> Yolo::runInference(const std::vector<cv::Mat>& inputs)
+{
+	std::vector<cv::Mat> modelInputs;
+	modelInputs.reserve(inputs.size());
+	for(const cv::Mat& input : inputs)
+	{
+		if(letterBoxForSquare && modelShape.width == modelShape.height)
+			modelInputs.push_back(formatToSquare(input));
+		else
+			modelInputs.push_back(input);
+	}
 
 	cv::Mat blob;
-	cv::dnn::blobFromImage(modelInput, blob, 1.0/255.0, modelShape, cv::Scalar(), true, false);
-	net.setInput(blob);
+	cv::dnn::blobFromImages(modelInputs, blob, 1.0/255.0, modelShape, cv::Scalar(), true, false);
+	std::vector<cv::Mat> outputs = forward(blob);
 
+	// the output has the shape (batchSize, rows, dimensions), split it into one 2d matrix per image
+	std::vector<std::vector<Detection>> detections;
+	detections.reserve(inputs.size());
+	for(size_t i = 0; i < inputs.size(); ++i)
+	{
+		cv::Mat output(outputs[0].size[1], outputs[0].size[2], CV_32F, outputs[0].ptr<float>(i));
+		detections.push_back(decodeOutput(output, modelInputs[i].size(), inputs[i].size()));
+	}
+	return detections;
+}
+
+std::vector<cv::Mat> Yolo::forward(const cv::Mat& blob)
+{
+	net.setInput(blob);
 	std::vector<cv::Mat> outputs;
 	net.forward(outputs, net.getUnconnectedOutLayersNames());
+	return outputs;
+}
 
-	int rows = outputs[0].size[1];
-	int dimensions = outputs[0].size[2];
+cv::Size Yolo::getModelShape() const
+{
+	return cv::Size(modelShape.width, modelShape.height);
+}
+
+std::vector<Yolo::Detection> Yolo::decodeOutput(const cv::Mat& output, const cv::Size& modelInputSize, const cv::Size& inputSize)
+{
+	int rows = output.rows;
+	int dimensions = output.cols;
+	cv::Mat data2d = output;
 
 	bool yolov8 = false;
 	// yolov5 has an output of shape (batchSize, 25200, 85) (Num classes + box[x,y,w,h] + confidence[c])
@@ -94,16 +130,15 @@ std::vector<Yolo::Detection> Yolo::runInference(const cv::Mat &input)
 	if (dimensions > rows) // Check if the shape[2] is more than shape[1] (yolov8)
 	{
 		yolov8 = true;
-		rows = outputs[0].size[2];
-		dimensions = outputs[0].size[1];
+		rows = output.cols;
+		dimensions = output.rows;
 
-		outputs[0] = outputs[0].reshape(1, dimensions);
-		cv::transpose(outputs[0], outputs[0]);
+		cv::transpose(output, data2d);
 	}
-	float *data = (float *)outputs[0].data;
+	float *data = (float *)data2d.data;
 
-	float x_factor = modelInput.cols / modelShape.width;
-	float y_factor = modelInput.rows / modelShape.height;
+	float x_factor = modelInputSize.width / modelShape.width;
+	float y_factor = modelInputSize.height / modelShape.height;
 
 	std::vector<int> class_ids;
 	std::vector<float> confidences;
@@ -186,28 +221,53 @@ std::vector<Yolo::Detection> Yolo::runInference(const cv::Mat &input)
 	{
 		int idx = nms_result[i];
 
-		Yolo::Detection result;
-		result.class_id = class_ids[idx];
-		result.confidence = confidences[idx];
-
-		std::random_device rd;
-		std::mt19937 gen(rd());
-		std::uniform_int_distribution<int> dis(100, 255);
-		result.color = cv::Scalar(dis(gen),
-		                          dis(gen),
-		                          dis(gen));
-
-		result.className = classes[result.class_id].first;
-		result.priority = classes[result.class_id].second;
-		clampBox(boxes[idx], input.size());
-		result.box = boxes[idx];
-		detections.push_back(result);
+		clampBox(boxes[idx], inputSize);
+		detections.push_back(makeDetection(class_ids[idx], confidences[idx], boxes[idx]));
 	}
 
 	return detections;
 }
 
 
+Yolo::Detection Yolo::makeDetection(int classId, float confidence, const cv::Rect& box) const
+{
+	Yolo::Detection result;
+	result.class_id = classId;
+	result.confidence = confidence;
+
+	std::random_device rd;
+	std::mt19937 gen(rd());
+	std::uniform_int_distribution<int> dis(100, 255);
+	result.color = cv::Scalar(dis(gen),
+	                          dis(gen),
+	                          dis(gen));
+
+	result.className = classes[result.class_id].first;
+	result.priority = classes[result.class_id].second;
+	result.box = box;
+	return result;
+}
+
+uint64_t Yolo::modelHash(const std::filesystem::path& onnxModelPath, const std::filesystem::path& classesTxtFilePath)
+{
+	uint64_t hash;
+	if(onnxModelPath.empty())
+	{
+		hash = hashBytes(rdefaultModelData, rdefaultModelSize);
+	}
+	else
+	{
+		std::string model = readFile(onnxModelPath);
+		hash = hashString(model);
+	}
+
+	if(classesTxtFilePath.empty())
+		hash = hashBytes(rdefaultClassesData, rdefaultClassesSize-1, hash);
+	else
+		hash = hashString(readFile(classesTxtFilePath), hash);
+	return hash;
+}
+
 void Yolo::clampBox(cv::Rect& box, const cv::Size& size)
 {
 	if(box.x < 0)
@@ -61,5 +61,12 @@ public:
 	Yolo(const std::filesystem::path &onnxModelPath = "", const cv::Size& modelInputShape = {640, 480},
 		const std::filesystem::path& classesTxtFilePath = "", bool runWithOCl = true);
 	std::vector<Detection> runInference(const cv::Mat &input);
+	std::vector<std::vector<Detection>> runInference(const std::vector<cv::Mat>& inputs);
+	// the steps of runInference, blob is made from images resized to getModelShape()
+	std::vector<cv::Mat> forward(const cv::Mat& blob);
+	std::vector<Detection> decodeOutput(const cv::Mat& output, const cv::Size& modelInputSize, const cv::Size& inputSize);
+	cv::Size getModelShape() const;
+	Detection makeDetection(int classId, float confidence, const cv::Rect& box) const;
 	int getClassForStr(const std::string& str) const;
+	static uint64_t modelHash(const std::filesystem::path& onnxModelPath = "", const std::filesystem::path& classesTxtFilePath = "");
 };